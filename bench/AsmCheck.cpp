@@ -0,0 +1,90 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Assembles small sources through libtchip16 and checks the program built,
+// or the errors reported, against what is expected: one case per bug that
+// was fixed. Exits with 1 if any case fails.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "libtchip16.h"
+
+struct AsmCase {
+    const char* name;
+    const char* source;
+    // Raw program expected, as hex bytes; NULL if the build must fail
+    const char* rom;
+    // Text the errors must hold, when it fails
+    const char* error;
+};
+
+static const AsmCase cases[] = {
+    // Internal opcode names are not mnemonics, and db without an operand
+    // is an error rather than a read past the tokens
+    { "db_str alone", "a: db_str\n", NULL, "db_str: unknown opcode" },
+    { "db_n alone", "a: db_n\n", NULL, "db_n: unknown opcode" },
+    // A name holding '-' is that name, when it is defined, before or after;
+    // otherwise a difference
+    { "hyphen label after", "jmp my-label\nmy-label: db 1\n", "1000040001", NULL },
+    { "hyphen label before", "db 7\nmy-label: db 1\njmp my-label\n", "070110000100", NULL },
+    { "hyphen equ", "x equ my-c\nmy-c equ 2+3\ndw x, my-c\n", "05000500", NULL },
+    { "hyphen string length", "my-str: db \"abc\"\nn equ $-my-str\ndw n\n", "6162630300", NULL },
+    { "difference", "my: db 5\nlabel: db 1\ndw my-label\n", "0501ffff", NULL },
+    // Every constant of a cycle is reported, not only the one it closes on
+    { "cycle first", "a equ b+1\nb equ c+1\nc equ a+1\nd equ 4\n", NULL,
+      "source.s:1: error: a: constant depends on itself" },
+    { "cycle second", "a equ b+1\nb equ c+1\nc equ a+1\nd equ 4\n", NULL,
+      "source.s:2: error: b: constant depends on itself" },
+    { "cycle third", "a equ b+1\nb equ c+1\nc equ a+1\nd equ 4\n", NULL,
+      "source.s:3: error: c: constant depends on itself" }
+};
+
+static std::string toHex(const std::vector<unsigned char>& rom) {
+    std::string s;
+    char b[4];
+    for(size_t i=0; i<rom.size(); ++i) {
+        snprintf(b,sizeof(b),"%02x",rom[i]);
+        s += b;
+    }
+    return s;
+}
+
+static bool check(const AsmCase& c) {
+    AssembleOptions opts;
+    opts.raw = true;
+    RomImage img;
+    bool ok = assembleText(c.source,opts,img);
+    const char* why = NULL;
+    if(c.rom && !ok)
+        why = "failed";
+    else if(!c.rom && ok)
+        why = "built, an error was expected";
+    else if(c.rom && toHex(img.rom) != c.rom)
+        why = "wrong program";
+    else if(c.error && img.diagnostics.find(c.error) == std::string::npos)
+        why = "missing error";
+    if(!why)
+        return true;
+    printf("%s: %s\n",c.name,why);
+    if(c.rom)
+        printf("    program %s, expected %s\n",toHex(img.rom).c_str(),c.rom);
+    if(c.error)
+        printf("    expected error: %s\n",c.error);
+    printf("%s",img.diagnostics.c_str());
+    return false;
+}
+
+int main() {
+    unsigned failed = 0, n = sizeof(cases)/sizeof(cases[0]);
+    for(unsigned i=0; i<n; ++i)
+        failed += !check(cases[i]);
+    printf("%u of %u assembler cases ok\n",n - failed,n);
+    return failed ? 1 : 0;
+}
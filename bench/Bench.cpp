@@ -0,0 +1,246 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// End-to-end benchmark: writes synthetic programs of several shapes, then
+// assembles each in a fresh process, timing every phase, and compares the
+// results with a stored baseline.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "Assembler.h"
+#include "SourceGen.h"
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double msSince(BenchClock::time_point t) {
+    return std::chrono::duration<double,std::milli>(BenchClock::now() - t).count();
+}
+
+// Best time of each phase over the runs
+struct Timing {
+    double tokenize, resolve, output, total;
+    long rssKb;
+    unsigned romBytes;
+};
+
+// Child side: assemble the sources in the current directory, as tchip16
+// would, runs times with the same assembler
+static int runShape(const std::vector<std::string>& sources, unsigned runs, unsigned jobs) {
+    Assembler tc16;
+    std::ostringstream errs;
+    tc16.setErrorStream(&errs);
+    tc16.setJobs(jobs);
+    Timing best = { 1e30, 1e30, 1e30, 1e30, 0, 0 };
+    for(unsigned r=0; r<runs; ++r) {
+        tc16.reset();
+        tc16.setOutputFile("out.c16");
+        BenchClock::time_point t0 = BenchClock::now();
+        for(unsigned i=0; i<sources.size(); ++i)
+            tc16.prefetch(sources[i]);
+        for(unsigned i=0; i<sources.size(); ++i) {
+            if(!tc16.tokenize(sources[i]))
+                break;
+        }
+        double tokenize = msSince(t0);
+        BenchClock::time_point t1 = BenchClock::now();
+        tc16.resolveConsts();
+        double resolve = msSince(t1);
+        BenchClock::time_point t2 = BenchClock::now();
+        tc16.outputFile();
+        double output = msSince(t2);
+        if(tc16.failed()) {
+            std::cerr << errs.str().substr(0,2000);
+            return 1;
+        }
+        best.tokenize = std::min(best.tokenize,tokenize);
+        best.resolve = std::min(best.resolve,resolve);
+        best.output = std::min(best.output,output);
+        best.total = std::min(best.total,tokenize + resolve + output);
+    }
+    printf("RESULT %.4f %.4f %.4f %.4f %ld %u\n",best.tokenize,best.resolve,best.output,
+           best.total,peakRssKb(),tc16.romSize());
+    return 0;
+}
+
+// Path to this program, to run it again for each shape
+static std::string selfPath(const char* argv0) {
+    char buf[4096];
+    ssize_t n = readlink("/proc/self/exe",buf,sizeof(buf) - 1);
+    if(n > 0)
+        return std::string(buf,n);
+    char* full = realpath(argv0,NULL);
+    std::string p = full ? full : argv0;
+    free(full);
+    return p;
+}
+
+// Parent side: one fresh process per shape, so that peak memory is its own
+static bool measure(const std::string& self, const std::string& dir, const GenOutput& gen,
+                    unsigned runs, unsigned jobs, Timing& t) {
+    std::ostringstream cmd;
+    cmd << "cd '" << dir << "' && '" << self << "' --runs " << runs << " --jobs " << jobs << " --run";
+    for(unsigned i=0; i<gen.sources.size(); ++i)
+        cmd << " '" << gen.sources[i] << "'";
+    FILE* child = popen(cmd.str().c_str(),"r");
+    if(!child)
+        return false;
+    char l[256];
+    bool ok = false;
+    while(fgets(l,sizeof(l),child)) {
+        if(sscanf(l,"RESULT %lf %lf %lf %lf %ld %u",&t.tokenize,&t.resolve,&t.output,
+                  &t.total,&t.rssKb,&t.romBytes) == 6)
+            ok = true;
+    }
+    return (pclose(child) == 0) && ok;
+}
+
+// shape -> (total ms, peak RSS KB)
+typedef std::map<std::string,std::pair<double,long> > Baseline;
+
+static bool loadBaseline(const char* fn, Baseline& base) {
+    std::ifstream in(fn);
+    if(!in)
+        return false;
+    std::string l;
+    while(std::getline(in,l)) {
+        if(l.empty() || l[0] == '#')
+            continue;
+        std::istringstream ls(l);
+        std::string name;
+        double ms;
+        long kb;
+        if(ls >> name >> ms >> kb)
+            base[name] = std::make_pair(ms,kb);
+    }
+    return true;
+}
+
+static void usage() {
+    std::cout << "Usage: tchip16_bench [--dir DIR] [--only SHAPE] [--runs N] [--jobs N]\n"
+                 "                     [--baseline FILE] [--save FILE] [--tolerance PCT]\n\n"
+                 "Writes synthetic programs under DIR (default bench/work), assembles each\n"
+                 "in a fresh process and prints the best time of each phase over N runs\n"
+                 "(default 3), lines per second and peak memory. With --baseline, exits\n"
+                 "with 1 if a shape got slower or bigger than the baseline by more than\n"
+                 "PCT percent (default 10); --save writes the results as the new baseline.\n\n"
+                 "Shapes:\n";
+    for(unsigned i=0; i<nbGenShapes; ++i)
+        printf("    %-10s %s\n",genShapes[i].name,genShapes[i].what);
+}
+
+int main(int argc, char* argv[]) {
+    std::string dir = "bench/work", only;
+    const char* baseFile = NULL;
+    const char* saveFile = NULL;
+    unsigned runs = 3, jobs = 1;
+    double tolerance = 10;
+    for(int i=1; i<argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--run")
+            return runShape(std::vector<std::string>(argv + i + 1,argv + argc),runs,jobs);
+        else if(i + 1 == argc) {
+            usage();
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+        else if(arg == "--dir")
+            dir = argv[++i];
+        else if(arg == "--only")
+            only = argv[++i];
+        else if(arg == "--runs")
+            runs = std::max(1,atoi(argv[++i]));
+        else if(arg == "--jobs")
+            jobs = std::max(1,atoi(argv[++i]));
+        else if(arg == "--baseline")
+            baseFile = argv[++i];
+        else if(arg == "--save")
+            saveFile = argv[++i];
+        else if(arg == "--tolerance")
+            tolerance = atof(argv[++i]);
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if(!only.empty() && !findShape(only)) {
+        std::cerr << "error: " << only << ": no such shape\n";
+        return 1;
+    }
+    Baseline base;
+    if(baseFile && !loadBaseline(baseFile,base)) {
+        std::cerr << "error: " << baseFile << ": cannot read baseline\n";
+        return 1;
+    }
+
+    std::string self = selfPath(argv[0]);
+    mkdir(dir.c_str(),0777);
+    char cwd[4096];
+    if(!getcwd(cwd,sizeof(cwd)))
+        return 1;
+
+    printf("%-9s %8s %5s %8s %10s %10s %10s %10s %10s %9s%s\n","shape","lines","files","rom",
+           "tokenize","resolve","output","total","lines/s","peak RSS",baseFile ? "  vs baseline" : "");
+    std::ostringstream saved;
+    saved << "# tchip16_bench baseline: shape, best total ms, peak RSS KB\n";
+    bool worse = false;
+    for(unsigned s=0; s<nbGenShapes; ++s) {
+        const GenShape& shape = genShapes[s];
+        if(!only.empty() && only != shape.name)
+            continue;
+        // Written again every time, always the same
+        std::string where = dir + "/" + shape.name;
+        mkdir(where.c_str(),0777);
+        GenOutput gen;
+        gen.lines = 0;
+        gen.files = 0;
+        gen.bytes = 0;
+        bool ok = chdir(where.c_str()) == 0 && shape.generate(gen);
+        ok = (chdir(cwd) == 0) && ok;
+        Timing t;
+        if(!ok || !measure(self,where,gen,runs,jobs,t)) {
+            printf("%-9s failed\n",shape.name);
+            worse = true;
+            continue;
+        }
+        printf("%-9s %8lu %5u %7.1fK %7.2f ms %7.2f ms %7.2f ms %7.2f ms %10.0f %6.1f MB",
+               shape.name,gen.lines,gen.files,t.romBytes/1024.0,t.tokenize,t.resolve,t.output,
+               t.total,gen.lines/(t.total/1000),t.rssKb/1024.0);
+        Baseline::iterator b = base.find(shape.name);
+        if(b != base.end()) {
+            double dt = 100*(t.total/b->second.first - 1);
+            double dm = 100*((double)t.rssKb/b->second.second - 1);
+            bool slower = dt > tolerance, bigger = dm > tolerance;
+            printf("  %+6.1f%% time %+6.1f%% RSS%s%s",dt,dm,slower ? "  SLOWER" : "",
+                   bigger ? "  BIGGER" : "");
+            worse = worse || slower || bigger;
+        }
+        printf("\n");
+        fflush(stdout);
+        saved << shape.name << " " << t.total << " " << t.rssKb << "\n";
+    }
+    if(saveFile) {
+        std::ofstream out(saveFile);
+        out << saved.str();
+        if(!out) {
+            std::cerr << "error: " << saveFile << ": cannot write baseline\n";
+            return 1;
+        }
+    }
+    return worse ? 1 : 0;
+}
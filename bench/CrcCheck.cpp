@@ -0,0 +1,90 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks that every backend of Crc32.h this CPU runs gives the same CRC as
+// crc_update: for each length up to a few blocks of the widest backend, at
+// each alignment, then over 64 KiB updated in uneven pieces. Exits with 1
+// on the first mismatch.
+
+#include <cstdio>
+#include <vector>
+
+#include "Crc32.h"
+
+static const CRC32_BACKEND backends[] = { CRC32_TABLE, CRC32_SLICE8, CRC32_CLMUL, CRC32_ARMV8 };
+static const unsigned nbBackends = sizeof(backends)/sizeof(backends[0]);
+
+static crc_t reference(const unsigned char* data, size_t n) {
+    return crc_finalize(crc_update(crc_init(),data,n));
+}
+
+static bool mismatch(CRC32_BACKEND b, const char* what, size_t offset, size_t n, crc_t got, crc_t want) {
+    printf("%s: %s, offset %lu, length %lu: %08lx instead of %08lx\n",crc32Name(b),what,
+           (unsigned long)offset,(unsigned long)n,(unsigned long)got,(unsigned long)want);
+    return false;
+}
+
+// Every length from 0 to maxLen, starting at each of 16 alignments
+static bool checkLengths(CRC32_BACKEND b, const std::vector<unsigned char>& data, size_t maxLen) {
+    for(size_t offset=0; offset<16; ++offset) {
+        for(size_t n=0; n<=maxLen; ++n) {
+            const unsigned char* p = data.data() + offset;
+            crc_t want = reference(p,n);
+            crc_t got = crc_finalize(crc32UpdateWith(b,crc_init(),p,n));
+            if(got != want)
+                return mismatch(b,"one update",offset,n,got,want);
+        }
+    }
+    return true;
+}
+
+// The whole buffer, updated a piece at a time, pieces of several sizes
+static bool checkChained(CRC32_BACKEND b, const std::vector<unsigned char>& data) {
+    static const size_t steps[] = { 1, 3, 7, 8, 15, 16, 63, 64, 65, 127, 1000, 4099 };
+    crc_t want = reference(data.data(),data.size());
+    for(unsigned s=0; s<sizeof(steps)/sizeof(steps[0]); ++s) {
+        crc_t c = crc_init();
+        size_t at = 0;
+        // Varying the piece size, so that pieces start at every alignment
+        for(size_t k=0; at < data.size(); ++k) {
+            size_t n = steps[s] + (k % 5);
+            if(n > data.size() - at)
+                n = data.size() - at;
+            c = crc32UpdateWith(b,c,data.data() + at,n);
+            at += n;
+        }
+        crc_t got = crc_finalize(c);
+        if(got != want)
+            return mismatch(b,"chained updates",0,steps[s],got,want);
+    }
+    return true;
+}
+
+int main() {
+    std::vector<unsigned char> data(64*1024 + 16);
+    unsigned long long s = 0x9E3779B97F4A7C15ULL;
+    for(size_t i=0; i<data.size(); ++i) {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        data[i] = (unsigned char)((s * 0x2545f4914f6cdd1dULL) >> 56);
+    }
+    std::vector<unsigned char> whole(data.begin(),data.begin() + 64*1024);
+    bool ok = true;
+    for(unsigned i=0; i<nbBackends; ++i) {
+        CRC32_BACKEND b = backends[i];
+        if(!crc32Supported(b)) {
+            printf("%-10s not supported by this CPU, skipped\n",crc32Name(b));
+            continue;
+        }
+        bool good = checkLengths(b,data,1200) && checkChained(b,whole);
+        printf("%-10s %s\n",crc32Name(b),good ? "ok" : "FAILED");
+        ok = ok && good;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,235 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Micro-benchmarks of the helpers every statement goes through: number
+// parsing, name lookups, instruction encoding, and the ROM CRC. Each case
+// is timed in batches long enough to read the clock, over several samples,
+// and reported in ns per operation with its spread.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Assembler.h"
+#include "Lookup.h"
+#include "Encoder.h"
+#include "Crc32.h"
+
+typedef std::chrono::steady_clock BenchClock;
+
+// Make the compiler believe the value is used
+template<class T>
+static inline void keep(const T& v) {
+    asm volatile("" : : "g"(&v) : "memory");
+}
+
+struct Stats {
+    double median, mean, stddev;
+};
+
+static unsigned nbSamples = 21;
+static double sampleMs = 2;
+
+// Time f(i) for i = 0, 1, ... in batches of n, n being grown until a
+// batch takes sampleMs
+template<class F>
+static Stats measure(F f) {
+    unsigned long n = 1;
+    for(;;) {
+        BenchClock::time_point t = BenchClock::now();
+        for(unsigned long i=0; i<n; ++i)
+            f(i);
+        double ms = std::chrono::duration<double,std::milli>(BenchClock::now() - t).count();
+        if(ms >= sampleMs || n >= (1ul << 30))
+            break;
+        n *= ms > 0 ? std::max(2.0,std::min(100.0,sampleMs/ms)) : 100;
+    }
+    std::vector<double> ns(nbSamples);
+    for(unsigned s=0; s<nbSamples; ++s) {
+        BenchClock::time_point t = BenchClock::now();
+        for(unsigned long i=0; i<n; ++i)
+            f(i);
+        ns[s] = std::chrono::duration<double,std::nano>(BenchClock::now() - t).count() / n;
+    }
+    Stats st;
+    st.mean = 0;
+    for(unsigned s=0; s<nbSamples; ++s)
+        st.mean += ns[s];
+    st.mean /= nbSamples;
+    st.stddev = 0;
+    for(unsigned s=0; s<nbSamples; ++s)
+        st.stddev += (ns[s] - st.mean)*(ns[s] - st.mean);
+    st.stddev = nbSamples > 1 ? sqrt(st.stddev/(nbSamples - 1)) : 0;
+    std::sort(ns.begin(),ns.end());
+    st.median = ns[nbSamples/2];
+    return st;
+}
+
+static const char* filter = NULL;
+
+static bool wanted(const std::string& group, const std::string& name) {
+    return !filter || (group + " " + name).find(filter) != std::string::npos;
+}
+
+static void report(const std::string& group, const std::string& name, const Stats& st,
+                   double bytes = 0) {
+    printf("%-8s %-24s %10.2f %10.2f %9.2f %6.1f%%",group.c_str(),name.c_str(),st.median,
+           st.mean,st.stddev,st.mean > 0 ? 100*st.stddev/st.mean : 0.0);
+    if(bytes > 0)
+        printf("  %7.2f GB/s",bytes/st.median);
+    printf("\n");
+    fflush(stdout);
+}
+
+// Each notation atoi_t takes, 16 values of each
+static void benchNumbers() {
+    static const char* formats[][2] = {
+        { "decimal",   "%u" },
+        { "negative",  "-%u" },
+        { "hex 0x",    "0x%04x" },
+        { "hex $",     "$%04x" },
+        { "hex #",     "#%04X" },
+        { "hex h",     "0%04xh" },
+        { "binary 0b", "0b" },
+        { "binary %",  "%%" },
+        { "char",      "'%c'" }
+    };
+    Assembler tc16;
+    for(unsigned f=0; f<sizeof(formats)/sizeof(formats[0]); ++f) {
+        if(!wanted("atoi_t",formats[f][0]))
+            continue;
+        char text[16][24];
+        std::string_view nums[16];
+        for(unsigned i=0; i<16; ++i) {
+            // Negative numbers fit in 15 bits, characters are letters
+            unsigned limit = f == 1 ? 0x8000 : f == 8 ? 26 : 0x10000;
+            unsigned v = (i*4099 + 17) % limit;
+            if(f == 6 || f == 7) {
+                // Binary, without leading zeros
+                int n = snprintf(text[i],sizeof(text[i]),formats[f][1]);
+                for(int b=15; b>=0; --b) {
+                    if(v >> b || b == 0)
+                        text[i][n++] = '0' + ((v >> b) & 1);
+                }
+                text[i][n] = '\0';
+            }
+            else
+                snprintf(text[i],sizeof(text[i]),formats[f][1],f == 8 ? 'a' + v : v);
+            nums[i] = text[i];
+        }
+        report("atoi_t",formats[f][0],measure([&](unsigned long i) {
+            u16 v = tc16.number(nums[i & 15]);
+            keep(v);
+        }));
+    }
+}
+
+// Every name of a table, in turn, then names that are not in it
+template<size_t N>
+static void benchTable(const char* name, const OpcodeName (&names)[N], int (*find)(std::string_view)) {
+    std::vector<std::string_view> hits, misses;
+    for(size_t i=0; i<N; ++i)
+        hits.push_back(names[i].name);
+    static const char* others[] = { "label1", "print_str", "loop", "x", "r16", "AddX", "sprite_data", "zz" };
+    for(size_t i=0; i<8; ++i)
+        misses.push_back(others[i]);
+    if(wanted("lookup",std::string(name) + " hit")) {
+        report("lookup",std::string(name) + " hit",measure([&](unsigned long i) {
+            int v = find(hits[i % hits.size()]);
+            keep(v);
+        }));
+    }
+    if(wanted("lookup",std::string(name) + " miss")) {
+        report("lookup",std::string(name) + " miss",measure([&](unsigned long i) {
+            int v = find(misses[i & 7]);
+            keep(v);
+        }));
+    }
+}
+
+static void benchLookups() {
+    benchTable("opcode",opcodeNames,findOpcode);
+    benchTable("mnemonic",mnemonicNames,findMnemonic);
+    benchTable("register",registerNames,findRegister);
+    benchTable("condition",conditionNames,findCondition);
+}
+
+// encodeOp for each opcode, with operands in range
+static void benchEncoders() {
+    for(size_t o=0; o<sizeof(opcodeNames)/sizeof(OpcodeName); ++o) {
+        OPCODE op = (OPCODE)opcodeNames[o].value;
+        const OpcodeLayout& l = formatTable[op];
+        if(!l.valid || !wanted("encode",opcodeNames[o].name))
+            continue;
+        unsigned short vals[16][3];
+        for(unsigned i=0; i<16; ++i) {
+            for(int a=0; a<3; ++a)
+                vals[i][a] = (unsigned short)((i*40503u + a*977u) & argLimit(l.args[a]));
+        }
+        unsigned char out[4];
+        report("encode",opcodeNames[o].name,measure([&](unsigned long i) {
+            encodeOp(out,op,l,vals[i & 15]);
+            keep(out);
+        }));
+    }
+}
+
+// A 64 KiB ROM with crc.c, then with each faster backend this CPU has
+static void benchCrc() {
+    std::vector<unsigned char> rom(64*1024);
+    for(size_t i=0; i<rom.size(); ++i)
+        rom[i] = (unsigned char)(i*131 + (i >> 8));
+    if(wanted("crc","crc_update 64K")) {
+        report("crc","crc_update 64K",measure([&](unsigned long) {
+            crc_t c = crc_finalize(crc_update(crc_init(),rom.data(),rom.size()));
+            keep(c);
+        }),rom.size());
+    }
+    static const CRC32_BACKEND fast[] = { CRC32_SLICE8, CRC32_CLMUL, CRC32_ARMV8 };
+    for(unsigned b=0; b<3; ++b) {
+        std::string name = std::string(crc32Name(fast[b])) + " 64K";
+        if(!crc32Supported(fast[b]) || !wanted("crc",name))
+            continue;
+        report("crc",name,measure([&](unsigned long) {
+            crc_t c = crc_finalize(crc32UpdateWith(fast[b],crc_init(),rom.data(),rom.size()));
+            keep(c);
+        }),rom.size());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    for(int i=1; i<argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--samples" && i + 1 < argc)
+            nbSamples = std::max(2,atoi(argv[++i]));
+        else if(arg == "--sample-ms" && i + 1 < argc)
+            sampleMs = std::max(0.1,atof(argv[++i]));
+        else if(arg[0] != '-')
+            filter = argv[i];
+        else {
+            printf("Usage: tchip16_microbench [--samples N] [--sample-ms MS] [FILTER]\n\n"
+                   "Times each case over N samples (default 21) of MS milliseconds\n"
+                   "(default 2) and prints the median and mean ns per operation, the\n"
+                   "standard deviation, and GB/s for the CRC. FILTER picks the cases\n"
+                   "whose \"group name\" contains it, eg \"atoi_t\" or \"encode add\".\n");
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+    }
+    printf("%-8s %-24s %10s %10s %9s %7s\n","group","case","median ns","mean ns","stddev","rsd");
+    benchNumbers();
+    benchLookups();
+    benchEncoders();
+    benchCrc();
+    return 0;
+}
@@ -0,0 +1,267 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdarg>
+#include <cstdio>
+
+#include "SourceGen.h"
+
+// xorshift64*, so that the programs do not depend on the C++ library
+class Rng {
+public:
+    explicit Rng(unsigned long long seed) : s(seed) {}
+    unsigned next() {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return (unsigned)((s * 0x2545f4914f6cdd1dULL) >> 32);
+    }
+    unsigned below(unsigned n) { return next() % n; }
+
+private:
+    unsigned long long s;
+};
+
+static void put(std::string& s, const char* fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args,fmt);
+    int n = vsnprintf(buf,sizeof(buf),fmt,args);
+    va_end(args);
+    s.append(buf,n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+static bool writeSource(GenOutput& out, const std::string& name, const std::string& text, bool root) {
+    FILE* fp = fopen(name.c_str(),"wb");
+    if(!fp)
+        return false;
+    bool ok = fwrite(text.data(),1,text.size(),fp) == text.size();
+    ok = (fclose(fp) == 0) && ok;
+    for(size_t i=0; i<text.size(); ++i)
+        out.lines += text[i] == '\n';
+    out.files++;
+    out.bytes += text.size();
+    if(root)
+        out.sources.push_back(name);
+    return ok;
+}
+
+static const char* words[] = {
+    "sprite", "palette", "frame", "update", "player", "enemy", "score", "timer",
+    "loop", "wait", "draw", "next", "tile", "map", "sound", "reset"
+};
+
+static void comment(std::string& s, Rng& rng) {
+    s += ';';
+    for(unsigned n = 2 + rng.below(8); n > 0; --n) {
+        s += ' ';
+        s += words[rng.below(16)];
+    }
+}
+
+// One instruction (4 bytes) with varied operands and number notations.
+// Labels are prefix0 to prefixN-1, constants (if any) c0 to cN-1.
+static void instruction(std::string& s, Rng& rng, const char* prefix, unsigned nbLabels,
+                        unsigned nbConsts = 0) {
+    unsigned x = rng.below(16), y = rng.below(16), z = rng.below(16);
+    unsigned kind = rng.below(16);
+    if(kind >= 11 && kind <= 14 && nbLabels == 0)
+        kind = 15;
+    if(nbConsts > 0 && rng.below(2)) {
+        put(s,rng.below(2) ? "ldi r%u, c%u" : "muli r%u, c%u",x,rng.below(nbConsts));
+        return;
+    }
+    switch(kind) {
+    case 0:  put(s,"add r%u, r%u",x,y); break;
+    case 1:  put(s,"sub r%u, r%u, r%u",x,y,z); break;
+    case 2:  put(s,"addi r%u, %u",x,rng.below(1000)); break;
+    case 3:  put(s,"muli r%u, 0x%x",x,rng.below(0x10000)); break;
+    case 4:  put(s,"ldm r%u, #%04X",x,rng.below(0x10000)); break;
+    case 5:  put(s,"mov r%u r%u",x,y); break;
+    case 6:  put(s,"stm r%u, r%u",x,y); break;
+    case 7:  put(s,"drw r%u, r%u, r%u",x,y,z); break;
+    case 8:  put(s,"rnd r%u, 0%02xh",x,rng.below(0x100)); break;
+    case 9:  put(s,"cmpi r%u, %u",x,rng.below(0x8000)); break;
+    case 10: put(s,"spr $%04x",rng.below(0x10000)); break;
+    case 11: put(s,"ldi r%u, %s%u",x,prefix,rng.below(nbLabels)); break;
+    case 12: put(s,"jmp %s%u",prefix,rng.below(nbLabels)); break;
+    case 13: put(s,"jnz %s%u",prefix,rng.below(nbLabels)); break;
+    case 14: put(s,"call %s%u",prefix,rng.below(nbLabels)); break;
+    default: {
+        static const char* bare[] = { "ret", "nop", "cls", "vblnk", "pushall", "popall" };
+        s += bare[rng.below(6)];
+    }
+    }
+}
+
+// Straight code: 14K instructions, a label every 8
+static bool genFlat(GenOutput& out) {
+    Rng rng(1);
+    const unsigned nb = 14000;
+    std::string s;
+    for(unsigned i=0; i<nb; ++i) {
+        if(i % 8 == 0)
+            put(s,"l%u: ",i/8);
+        s += '\t';
+        instruction(s,rng,"l",nb/8);
+        if(rng.below(10) == 0) {
+            s += "\t\t";
+            comment(s,rng);
+        }
+        s += '\n';
+    }
+    return writeSource(out,"flat.s",s,true);
+}
+
+// A million lines, mostly comments and blank ones, with 10K instructions
+// and 50K constants among them
+static bool genHuge(GenOutput& out) {
+    Rng rng(2);
+    const unsigned nb = 1000000;
+    std::string s;
+    s.reserve(40*nb);
+    unsigned nbLabels = nb/100/4, label = 0, constant = 0;
+    for(unsigned i=0; i<nb; ++i) {
+        unsigned at = i % 100;
+        if(at == 0) {
+            if((i/100) % 4 == 0)
+                put(s,"h%u:",label++);
+            s += '\t';
+            instruction(s,rng,"h",nbLabels);
+        }
+        else if(at <= 5)
+            put(s,"k%u\tequ %u",constant++,rng.below(0x10000));
+        else if(at < 70)
+            comment(s,rng);
+        else if(at % 3 == 0) {
+            s += "\t\t";
+            comment(s,rng);
+        }
+        s += '\n';
+    }
+    return writeSource(out,"huge.s",s,true);
+}
+
+// 40K constants between 12K instructions that use them, a label on
+// every other one
+static bool genSymbols(GenOutput& out) {
+    Rng rng(3);
+    const unsigned nbConsts = 40000, nbCode = 12000;
+    std::string s;
+    unsigned c = 0;
+    for(unsigned i=0; i<nbCode; ++i) {
+        // Ten constants every three instructions
+        for(; c < nbConsts && c < (i+3)*nbConsts/nbCode; ++c)
+            put(s,"c%u equ 0x%04x\n",c,rng.below(0x10000));
+        if(i % 2 == 0)
+            put(s,"s%u: ",i/2);
+        s += '\t';
+        instruction(s,rng,"s",nbCode/2,nbConsts);
+        s += '\n';
+    }
+    return writeSource(out,"symbols.s",s,true);
+}
+
+// A tree of includes, 3 per file and 8 levels deep (3280 files), each
+// with 4 instructions calling into the files it includes
+static bool genIncludes(GenOutput& out) {
+    Rng rng(4);
+    const unsigned nb = 3280;
+    for(unsigned n=0; n<nb; ++n) {
+        std::string s, prefix;
+        put(prefix,"f%u_",n);
+        for(unsigned c=3*n+1; c<=3*n+3 && c<nb; ++c)
+            put(s,"include n%u.s\n",c);
+        put(s,"%s0:",prefix.c_str());
+        for(unsigned i=0; i<4; ++i) {
+            s += '\t';
+            if(i == 1 && 3*n+1 < nb)
+                put(s,"call f%u_0",3*n+1+rng.below(3*n+3 < nb ? 3 : nb-3*n-1));
+            else
+                instruction(s,rng,prefix.c_str(),1);
+            s += '\n';
+        }
+        std::string name;
+        put(name,"n%u.s",n);
+        if(!writeSource(out,name,s,n == 0))
+            return false;
+    }
+    return true;
+}
+
+// 2500 lines of db and 1000 of dw, 56K of data, and code reading them
+static bool genTables(GenOutput& out) {
+    Rng rng(5);
+    const unsigned nbDb = 2500, nbDw = 1000, nbCode = 100;
+    unsigned nbLabels = (nbDb + nbDw)/10;
+    std::string s;
+    for(unsigned i=0; i<nbCode; ++i)
+        put(s,"\tldi r%u, t%u\n",rng.below(16),rng.below(nbLabels));
+    static const char* byteFormats[] = { "0x%02x", "$%02x", "#%02x", "%u", "0%02xh" };
+    for(unsigned i=0; i<nbDb + nbDw; ++i) {
+        if(i % 10 == 0)
+            put(s,"t%u:",i/10);
+        if(i < nbDb) {
+            s += "\tdb ";
+            for(unsigned b=0; b<16; ++b) {
+                if(b)
+                    s += ", ";
+                put(s,byteFormats[rng.below(5)],rng.below(0x100));
+            }
+        }
+        else {
+            s += "\tdw ";
+            for(unsigned w=0; w<8; ++w) {
+                if(w)
+                    s += ", ";
+                if(rng.below(4) == 0)
+                    put(s,"-%u",rng.below(0x8000));
+                else
+                    put(s,"%u",rng.below(0x10000));
+            }
+        }
+        s += '\n';
+    }
+    return writeSource(out,"tables.s",s,true);
+}
+
+// 3000 strings with a $- constant for each length, and code using both
+static bool genStrings(GenOutput& out) {
+    Rng rng(6);
+    const unsigned nb = 3000, nbCode = 1000;
+    std::string s;
+    for(unsigned i=0; i<nb; ++i)
+        put(s,"n%u\tequ $-s%u\n",i,i);
+    for(unsigned i=0; i<nbCode; ++i)
+        put(s,rng.below(2) ? "\tldi r%u, n%u\n" : "\tldi r%u, s%u\n",rng.below(16),rng.below(nb));
+    for(unsigned i=0; i<nb; ++i) {
+        put(s,"s%u:\tdb \"",i);
+        for(unsigned n = 4 + rng.below(17); n > 0; --n)
+            s += rng.below(6) == 0 ? ' ' : (char)('a' + rng.below(26));
+        s += "\"\n";
+    }
+    return writeSource(out,"strings.s",s,true);
+}
+
+const GenShape genShapes[] = {
+    { "flat",     "14K instructions with labels",           genFlat },
+    { "huge",     "1M lines, mostly comments",               genHuge },
+    { "symbols",  "40K equ constants, 6K labels",            genSymbols },
+    { "includes", "3280 files included 8 levels deep",       genIncludes },
+    { "tables",   "56K of db/dw tables",                     genTables },
+    { "strings",  "3000 strings with $- length constants",   genStrings }
+};
+const unsigned nbGenShapes = sizeof(genShapes)/sizeof(genShapes[0]);
+
+const GenShape* findShape(const std::string& name) {
+    for(unsigned i=0; i<nbGenShapes; ++i) {
+        if(name == genShapes[i].name)
+            return &genShapes[i];
+    }
+    return NULL;
+}
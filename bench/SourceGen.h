@@ -0,0 +1,39 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SOURCEGEN_H
+#define _SOURCEGEN_H
+
+#include <string>
+#include <vector>
+
+// Sources written for a shape: the files to pass to tokenize, in order,
+// and how much was written in all
+struct GenOutput {
+	std::vector<std::string> sources;
+	unsigned long lines;
+	unsigned files;
+	unsigned long bytes;
+};
+
+// A kind of synthetic program. Every shape fits in 64K and assembles
+// without errors, and is the same from one run (or machine) to the next.
+struct GenShape {
+	const char* name;
+	const char* what;
+	// Write the sources in the current directory; false if one could not be
+	bool (*generate)(GenOutput&);
+};
+
+extern const GenShape genShapes[];
+extern const unsigned nbGenShapes;
+
+// Shape of that name, NULL if there is none
+const GenShape* findShape(const std::string&);
+
+#endif
@@ -0,0 +1,70 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "AllocCount.h"
+
+static std::atomic<unsigned long long> allocs(0);
+
+unsigned long long heapAllocations() {
+    return allocs.load(std::memory_order_relaxed);
+}
+
+static void* countedAlloc(std::size_t n) {
+    allocs.fetch_add(1,std::memory_order_relaxed);
+    return malloc(n ? n : 1);
+}
+
+void* operator new(std::size_t n) {
+    void* p = countedAlloc(n);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t n) {
+    void* p = countedAlloc(n);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept {
+    return countedAlloc(n);
+}
+
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept {
+    return countedAlloc(n);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    free(p);
+}
@@ -0,0 +1,17 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _ALLOCCOUNT_H
+#define _ALLOCCOUNT_H
+
+// Heap allocations made through operator new so far. Counted by replacing
+// the global operator new, which only the tchip16 program links in: the
+// library leaves it to the programs using it.
+unsigned long long heapAllocations();
+
+#endif
@@ -0,0 +1,105 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+// Memory handed out by moving a pointer along big blocks, and given back
+// all at once by reset(), which keeps the blocks for the next time. Once
+// an assembler has seen a program as large as the next one, building it
+// takes no memory from the heap.
+class Arena {
+public:
+	explicit Arena(size_t block = 64*1024) : blockSize(block), cur(0), used(0) {}
+	~Arena() {
+		for(size_t i=0; i<blocks.size(); ++i)
+			delete[] blocks[i].data;
+	}
+
+	// n bytes aligned to align (a power of two, up to that of new[])
+	void* alloc(size_t n, size_t align) {
+		for(;;) {
+			if(cur < blocks.size()) {
+				size_t p = (used + align - 1) & ~(align - 1);
+				if(p + n <= blocks[cur].size) {
+					used = p + n;
+					return blocks[cur].data + p;
+				}
+				// Whatever is left of this block is wasted until reset
+				++cur;
+				used = 0;
+				continue;
+			}
+			Block b;
+			b.size = n + align > blockSize ? n + align : blockSize;
+			b.data = new char[b.size];
+			blocks.push_back(b);
+		}
+	}
+	// Copy of a string, followed by a '\0' so that it can be opened
+	std::string_view copy(std::string_view s) {
+		char* p = (char*)alloc(s.size() + 1,1);
+		memcpy(p,s.data(),s.size());
+		p[s.size()] = '\0';
+		return std::string_view(p,s.size());
+	}
+	// Forget everything handed out, keeping the blocks
+	void reset() {
+		cur = 0;
+		used = 0;
+	}
+	size_t capacity() const {
+		size_t n = 0;
+		for(size_t i=0; i<blocks.size(); ++i)
+			n += blocks[i].size;
+		return n;
+	}
+
+private:
+	Arena(const Arena&);
+	Arena& operator=(const Arena&);
+
+	struct Block {
+		char* data;
+		size_t size;
+	};
+	std::vector<Block> blocks;
+	size_t blockSize;
+	size_t cur;			// block being handed out
+	size_t used;		// bytes of it gone
+};
+
+// Allocator for standard containers that live in an arena: freeing is a
+// no-op, the memory comes back with Arena::reset(). Clear the container
+// before resetting its arena.
+template<class T>
+class ArenaAllocator {
+public:
+	typedef T value_type;
+
+	explicit ArenaAllocator(Arena* a) : arena(a) {}
+	template<class U>
+	ArenaAllocator(const ArenaAllocator<U>& o) : arena(o.arena) {}
+
+	T* allocate(size_t n) { return (T*)arena->alloc(n*sizeof(T),alignof(T)); }
+	void deallocate(T*, size_t) {}
+
+	template<class U>
+	bool operator==(const ArenaAllocator<U>& o) const { return arena == o.arena; }
+	template<class U>
+	bool operator!=(const ArenaAllocator<U>& o) const { return arena != o.arena; }
+
+	Arena* arena;
+};
+
+#endif
@@ -7,622 +7,656 @@
 */
 
 #include <iostream>
-#include <fstream>
+#include <cstdlib>
+#include <cstring>
 #include <sstream>
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 
 #include "Assembler.h"
+#include "Lookup.h"
+#include "Encoder.h"
+#include "Number.h"
+#include "Expression.h"
+#include "Trace.h"
 #include "RomHeader.h"
-#include "crc.h"
+#include "Crc32.h"
+#include "Hash.h"
 
 extern const char* tchip16_ver;
 
-Assembler::Assembler() {
+// Statements per thread below which writing the output isn't worth splitting
+const unsigned EMIT_CHUNK_MIN = 4096;
+
+struct EmitChunk {
+    u32 first, last;            // statements [first,last)
+    int start;                  // value of the last start directive, -1 if none
+    std::ostringstream diag;    // errors, printed once every chunk is done
+    ErrorLog log;
+
+    EmitChunk() : log(&diag) {}
+};
+
+// Names of an expression once symbols are known: their values, or failing
+// that numbers like "ffh"
+class SymbolValues : public ExprNames {
+public:
+    explicit SymbolValues(const SymbolTable& s) : symbols(s) {}
+    bool value(std::string_view name, long long& v) {
+        int id = symbols.find(name);
+        if(id >= 0 && symbols[id].kind != SYM_NONE) {
+            v = symbols[id].value;
+            return true;
+        }
+        unsigned short n;
+        if(parseNumber(name,n) != NUM_OK)
+            return false;
+        v = n;
+        return true;
+    }
+
+private:
+    const SymbolTable& symbols;
+};
+
+// Names of an expression as symbol ids, interned
+class SymbolRefs : public ExprNames {
+public:
+    SymbolRefs(SymbolTable& s, std::vector<int>& i) : symbols(s), ids(i) {}
+    bool value(std::string_view name, long long& v) {
+        ids.push_back(symbols.intern(name));
+        v = 0;
+        return true;
+    }
+
+private:
+    SymbolTable& symbols;
+    std::vector<int>& ids;
+};
+
+// Could a token be a name, which may hold '-' (my-label) but no other
+// operator
+static bool hyphenName(std::string_view s) {
+    return !s.empty() && s[0] != '-' &&
+           s.find_first_of("+*/%&|^~<>()$'") == std::string_view::npos;
+}
+
+Assembler::Assembler()
+    : symbols(arena) {
     // Initialize
-    initMaps();
+    nbSources = 0;
     lineNb = 0;
+    curFile = 0;
+    curLine = 0;
+    lastLabel = -1;
     curAddress = 0;
     totalBytes = 0;
+    codeBytes = 0;
     verbose = false;
     zeroFill = false;
     alignLabels = false;
     writeMmap = false;
     writeHeader = true;
+    jobs = 1;
     outputFP = "output.c16";
     start = 0;
     version = 1.1f;
     curB = 0;
+    romBytes = 0;
+    bytesRead = 0;
     buffer = new u8[MEM_SIZE];
+    files = NULL;
+    pool = NULL;
+    memo = NULL;
+    memoKey = 0;
 }
 
 Assembler::~Assembler() {
-    delete buffer;
+    // Finish reading ahead before the sources go away
+    delete pool;
+    delete memo;
+    delete[] buffer;
+}
+
+void Assembler::reset() {
+    // Containers keep their capacity, and what is in the arena goes with it
+    tokens.clear();
+    stmts.clear();
+    operands.clear();
+    imports.clear();
+    deferred.clear();
+    constDeps.clear();
+    strLens.clear();
+    symbols.clear();
+    filesImp.clear();
+    fileSources.clear();
+    memoInputs.clear();
+    // Tokenizing may have stopped on an error with sources still being
+    // read ahead, into the SourceFiles about to be closed
+    waitPrefetched();
+    {
+        std::lock_guard<std::mutex> lock(prefetchLock);
+        prefetched.clear();
+        for(unsigned i=0; i<nbSources; ++i)
+            sources[i].close();
+        nbSources = 0;
+    }
+    arena.reset();
+    log.clear();
+
+    lineNb = 0;
+    curFile = 0;
+    curLine = 0;
+    lastLabel = -1;
+    curAddress = 0;
+    totalBytes = 0;
+    codeBytes = 0;
+    verbose = false;
+    zeroFill = false;
+    alignLabels = false;
+    writeMmap = false;
+    writeHeader = true;
+    outputFP = "output.c16";
+    start = 0;
+    version = 1.1f;
+    curB = 0;
+    romBytes = 0;
+    memoKey = 0;
+    stats.clear();
+    bytesRead = 0;
 }
 
 void Assembler::setOutputFile(const char* fn) {
     outputFP = fn;
 }
 
-void Assembler::tokenize(const char* fn) {
-    std::string f(fn);
+bool Assembler::tokenize(std::string_view fn) {
+    TRACE_SPAN_FILE("tokenize",fn);
+    if(!stats.enabled())
+        return tokenizeFile(fn);
+    // Included files are phases of their own
+    unsigned ph = stats.begin("tokenize",statCounts(),fn);
+    bool ok = tokenizeFile(fn);
+    stats.end(ph,statCounts());
+    return ok;
+}
+
+StatCounts Assembler::statCounts() const {
+    StatCounts c = { bytesRead, stmts.size(), tokens.size(), (u64)symbols.size() };
+    return c;
+}
+
+bool Assembler::tokenizeFile(std::string_view fn) {
+    // Kept in the arena, with a '\0' to open it by
+    std::string_view f = arena.copy(fn);
     // Check for import cycles
     for(lineNb=0; lineNb<filesImp.size(); ++lineNb) {
-        if(filesImp[lineNb].compare(f) == 0) {
-            Error::error(ERR_INC_CYCLE);
-            exit(1);
+        if(filesImp[lineNb] == f) {
+            log.error(ERR_INC_CYCLE);
+            return false;
         }
     }
+    int fileId = filesImp.size();
     filesImp.push_back(f);
 
 #ifdef _DEBUG
     std::cout << "Parsing file: " << f << "\n";
 #endif
 
-    // Open the file
-    std::ifstream file(fn);
-    if(!file.is_open()) {
-        Error::error(ERR_IO);
-        exit(1);
+    // Map the file, it stays mapped until the assembler goes away
+    SourceFile* file = openSource(f);
+    if(!file) {
+        log.error(ERR_IO);
+        return false;
     }
-    // Get a line
-    std::string ln;
+    fileSources.push_back(file);
+    bytesRead += file->size();
+    TRACE_ARG("lines",file->lineCount());
+    line& toks = lineToks;
     int lineNbAlt = 0;
-    while(std::getline(file,ln)) {
-        // Get a string with bad chars in case of db string
-        std::string badString;
-        int badStart = 0, badEnd = ln.length()-1;
-        for( ; badStart<(int)ln.length() && ln[badStart] != '"'; ++badStart){}
-        for( ; badEnd>=0 && ln[badEnd] != '"'; --badEnd){}
-        badString = ln.substr(badStart, badEnd - badStart + 1);
-
+    for(unsigned l=0; l<file->lineCount(); ++l) {
+        file->getLine(l,toks);
         lineNbAlt++;
-        // Strip ',' from the string
-        std::replace(ln.begin(),ln.end(),',',' ');
-        // Get tokens from the line
-        line toks;
-        std::string tok;
-        std::stringstream ss(ln);
-        while(ss >> tok)
-            toks.push_back(tok);
-        // Some basic parsing
-        for(lineNb=0; lineNb<toks.size(); ++lineNb) {
-            if(toks[lineNb] == "\t" || toks[lineNb] == "")
-                toks.erase(toks.begin()+lineNb);
-            else if(toks[lineNb][0] == ';')
-                toks.resize(lineNb);
-        }
+        // Not a statement (yet), errors refer to the file position
+        lineNb = stmts.size();
+        curFile = fileId;
+        curLine = lineNbAlt;
         // Parse some directives
         if(!toks.empty()) {
             if(toks[0] == "include") {
                 if(toks.size() == 1)
-                    Error::error(ERR_INC_NONE,f,lineNbAlt,toks[0]);
+                    log.error(ERR_INC_NONE,f,lineNbAlt,toks[0]);
                 else if(toks.size() > 2)
-                    Error::error(ERR_TOO_MANY,f,lineNbAlt,toks[0]);
-                else
-                    tokenize(toks[1].c_str());
+                    log.error(ERR_TOO_MANY,f,lineNbAlt,toks[0]);
+                else if(!tokenize(toks[1]))
+                    return false;
             }
             else if(toks[0] == "importbin") {
                 if(toks.size() < 5)
-                    Error::error(ERR_OP_ARGS,f,lineNbAlt,toks[0]);
+                    log.error(ERR_OP_ARGS,f,lineNbAlt,toks[0]);
                 else if(toks.size() > 5)
-                    Error::error(ERR_TOO_MANY,f,lineNbAlt,toks[0]);
-                else if(std::find(labelNames.begin(),labelNames.end(),toks[3]) != labelNames.end())
-                    Error::error(ERR_LABEL_REDEF,f,lineNbAlt,toks[3]);
+                    log.error(ERR_TOO_MANY,f,lineNbAlt,toks[0]);
                 else {
-                    toks.erase(toks.begin(),toks.begin()+1);
-                    imports.push_back(toks);
-                    labelNames.push_back(toks[3]);
+                    // Address is only known once all the code is laid out
+                    int id = symbols.intern(toks[4]);
+                    if(!symbols.define(id,SYM_IMPORT,0,fileId,lineNbAlt))
+                        log.error(ERR_LABEL_REDEF,f,lineNbAlt,toks[4]);
+                    else {
+                        ImportBin imp;
+                        imp.file = toks[1];
+                        imp.label = toks[4];
+                        imp.offset = atoi_t(toks[2]);
+                        imp.size = atoi_t(toks[3]);
+                        if(!readImport(imp))
+                            log.error(ERR_IO,f,lineNbAlt,toks[1]);
+                        else if((u64)imp.offset + imp.size > imp.data.size())
+                            log.error(ERR_IMPORT_RANGE,f,lineNbAlt,toks[1]);
+                        else {
+                            imports.push_back(imp);
+                            bytesRead += imp.size;
+                        }
+                        lastLabel = id;
+                    }
                 }
             }
             else if(toks.size() > 1 && toks[1] == "equ") {
                 if(toks.size() < 3)
-                    Error::error(ERR_OP_ARGS,f,lineNbAlt,toks[1]);
+                    log.error(ERR_OP_ARGS,f,lineNbAlt,toks[1]);
                 else if(toks.size() > 3)
-                    Error::error(ERR_TOO_MANY,f,lineNbAlt,toks[1]);
-                else if(std::find(constNames.begin(),constNames.end(),toks[0]) != constNames.end())
-                    Error::error(ERR_CONST_REDEF,f,lineNbAlt,toks[0]);
-                else if(toks[2].size() > 2 && toks[2][0] == '$' && toks[2][1] == '-') {
-                    unresConsts[toks[0]] =
-                        std::make_pair<int,std::string>(lineNbAlt,toks[2].substr(2,toks[2].size()-2));
-                }
-                else if(atoi_t(toks[2]) > 0xFFFF)
-                    Error::error(ERR_NUM_OVERFLOW,f,lineNbAlt,toks[1]);
-                else {
-                    // Add to map
-                    consts[toks[0]] = atoi_t(toks[2]);
-                    constNames.push_back(toks[0]);
-                }
+                    log.error(ERR_TOO_MANY,f,lineNbAlt,toks[1]);
+                else if(!symbols.define(symbols.intern(toks[0]),SYM_CONST,0,fileId,lineNbAlt))
+                    log.error(ERR_CONST_REDEF,f,lineNbAlt,toks[0]);
+                else if(toks[2].size() > 2 && toks[2][0] == '$' && toks[2][1] == '-' &&
+                        !startsNumber(toks[2].substr(2)) && hyphenName(toks[2].substr(2)))
+                    deferConst(toks[0],toks[2].substr(2),true,fileId,lineNbAlt);
+                else if(startsNumber(toks[2]) && !isExpression(toks[2]))
+                    symbols[symbols.find(toks[0])].value = atoi_t(toks[2]);
+                else
+                    deferConst(toks[0],toks[2],false,fileId,lineNbAlt);
             }
             else if(toks[0] == "version") {
                 if(toks.size() == 1)
-                    Error::error(ERR_OP_ARGS,f,lineNbAlt,toks[0]);
+                    log.error(ERR_OP_ARGS,f,lineNbAlt,toks[0]);
                 else if(toks.size() > 2)
-                    Error::error(ERR_TOO_MANY,f,lineNbAlt,toks[0]);
+                    log.error(ERR_TOO_MANY,f,lineNbAlt,toks[0]);
                 else {
-                    std::stringstream vss(toks[1]);
-                    vss >> version;
+                    char num[32] = {};
+                    toks[1].copy(num,sizeof(num)-1);
+                    version = strtof(num,NULL);
                 }
             }
             else {
                 if(toks[0].size() > 1 &&
                    ((toks[0][0] == ':') || (toks[0][toks[0].size()-1] == ':'))) {
-                       std::string label;
+                       std::string_view label;
                        if(toks[0][0] == ':')
                            label = toks[0].substr(1,toks[0].size()-1);
                        else
                            label = toks[0].substr(0,toks[0].size()-1);
                        int pad = alignLabels ? (totalBytes % 4 != 0 ? 4 - (totalBytes % 4) : 0) : 0;
-                       if(consts.find(label) != consts.end())
-                           Error::error(ERR_LABEL_REDEF,f,lineNbAlt,label);
-                       else {
-                           // Add to map
-                           consts[label] = totalBytes + pad;
-                           // Add to label list
-                           labelNames.push_back(label);
-                       }
+                       int id = symbols.intern(label);
+                       if(!symbols.define(id,SYM_LABEL,totalBytes + pad,fileId,lineNbAlt))
+                           log.error(ERR_LABEL_REDEF,f,lineNbAlt,label);
+                       else
+                           lastLabel = id;
                        // Remove token
                        toks.erase(toks.begin());
                 }
                 // If after all this there is something left, add it
                 if(!toks.empty()) {
-                    // Ensure the mnemonic is lowercase
-                    std::transform(toks[0].begin(),toks[0].end(),toks[0].begin(),::tolower);
+                    // Use the table spelling of the mnemonic, which is lowercase
+                    int m;
+                    if((m = opcodeTable.find(toks[0])) >= 0)
+                        toks[0] = opcodeTable[m].name;
+                    else if((m = mnemonicTable.find(toks[0])) >= 0)
+                        toks[0] = mnemonicTable[m].name;
                     // If the mnemonic uses a conditional type, fix it
-                    if(toks[0].size() > 1 &&
-                        ((toks[0][0] == 'j' && (toks[0] == "jmz" || toks[0][1] != 'm')) ||
-                        ((toks[0][0] == 'c') && (toks[0] != "call") && 
-                        (toks[0] != "cls") && (toks[0] != "cmpi") && 
-                        (toks[0] != "cmp")))) {
+                    char c0 = toks[0].size() > 1 ? lowerChar(toks[0][0]) : 0;
+                    if((c0 == 'j' && (sameName(toks[0],"jmz") || lowerChar(toks[0][1]) != 'm')) ||
+                        ((c0 == 'c') && !sameName(toks[0],"call") && 
+                        !sameName(toks[0],"cls") && !sameName(toks[0],"cmpi") && 
+                        !sameName(toks[0],"cmp"))) {
                             toks.insert(toks.begin()+1,toks[0].substr(1));
-                            toks[0] = toks[0].substr(0,1);
-                            toks[0].append("x");
+                            toks[0] = c0 == 'j' ? "jx" : "cx";
                     }
-                    tokens.push_back(toks);
-                    lines.push_back(lineNbAlt);
-                    files.push_back(std::string(fn));
-                    if(toks[0] == "db" && toks.size() > 1) {
-                        if(toks[1][0] == '"') {
-                            // Drop messed up tokens and inject correct string
-                            tokens[tokens.size()-1].resize(1);
-                            tokens[tokens.size()-1].push_back(badString);
-                            totalBytes += badString.size() - 2;
-                            if(!labelNames.empty())
-                                stringLines[labelNames.back()] = lineNbAlt;
-                            else
-                                Error::error(ERR_STR_NOLABEL,fn,lineNbAlt,toks[1]);
-                            // Old, hacky way
-                            /*for(unsigned i=1; i<toks.size(); ++i)
-                                totalBytes += toks[i].size();
-                            // Allow for spaces
-                            totalBytes += toks.size() - 2;
-                            // Remove both quote marks
-                            totalBytes -= 2;
-                            */
+                    // A db string is a single token, drop anything after it
+                    if(toks[0] == "db" && toks.size() > 2 && toks[1][0] == '"')
+                        toks.resize(2);
+                    Statement st;
+                    st.tok = tokens.size();
+                    st.size = toks.size();
+                    st.file = fileId;
+                    st.line = lineNbAlt;
+                    st.addr = totalBytes;
+                    tokens.insert(tokens.end(),toks.begin(),toks.end());
+                    // Errors from here on refer to the statement
+                    lineNb = stmts.size();
+                    stmts.push_back(st);
+                    decode(stmts.back());
+                    int pad;
+                    switch(stmts.back().op) {
+                    case DB_STR:
+                        totalBytes += toks[1].size() - 2;
+                        if(lastLabel >= 0) {
+                            // For $-: the latest string after a label wins
+                            if(lastLabel >= (int)strLens.size())
+                                strLens.resize(lastLabel + 1,-1);
+                            strLens[lastLabel] = toks[1].size() - 2;
                         }
                         else
-                            totalBytes += toks.size() - 1;
-                        int pad = alignLabels ? (totalBytes % 4 != 0 ? 4 - (totalBytes % 4) : 0) : 0;
+                            log.error(ERR_STR_NOLABEL,fn,lineNbAlt,toks[1]);
+                        pad = alignLabels ? (totalBytes % 4 != 0 ? 4 - (totalBytes % 4) : 0) : 0;
                         totalBytes += pad;
-                    }
-                    else if(toks[0] == "dw" && toks.size() > 1) {
+                        break;
+                    case DB:
+                        totalBytes += toks.size() - 1;
+                        pad = alignLabels ? (totalBytes % 4 != 0 ? 4 - (totalBytes % 4) : 0) : 0;
+                        totalBytes += pad;
+                        break;
+                    case DW:
                         totalBytes += 2*(toks.size() - 1);
-                        int pad = alignLabels ? (totalBytes % 4 != 0 ? 4 - (totalBytes % 4) : 0) : 0;
+                        pad = alignLabels ? (totalBytes % 4 != 0 ? 4 - (totalBytes % 4) : 0) : 0;
                         totalBytes += pad;
-                    }
-                    else if(toks[0] != "start")
+                        break;
+                    case START:
+                        break;
+                    case OP_NONE:
+                        // Not decoded (already reported), takes no room so
+                        // that the labels after it keep their addresses
+                        break;
+                    default:
                         totalBytes += 4;
+                        break;
+                    }
+                    codeBytes = totalBytes;
                 }
             }
         }
     }
+    return true;
+}
 
-    file.close();
-    // Remember the imports!
-    for(unsigned i=0; i<imports.size(); ++i) {
-        int pad = alignLabels ? (totalBytes % 4 != 0 ? 4 - (totalBytes % 4) : 0) : 0;
-        consts[imports[i][3]] = totalBytes + pad;
-        totalBytes += atoi_t(imports[i][2]);
-    }
+void Assembler::prefetch(const std::string& fn) {
+    if(!pool)
+        return;
+    std::lock_guard<std::mutex> lock(prefetchLock);
+    if(prefetched.count(fn))
+        return;
+    SourceFile* file = newSource();
+    std::shared_ptr<std::packaged_task<SourceFile*()> > task =
+        std::make_shared<std::packaged_task<SourceFile*()> >([this,file,fn]() -> SourceFile* {
+            TRACE_SPAN_FILE("lex",fn);
+            if(!openFile(*file,fn))
+                return NULL;
+            file->lex();
+            TRACE_ARG("lines",file->lineCount());
+            prefetchIncludes(*file);
+            return file;
+        });
+    prefetched[fn] = task->get_future().share();
+    pool->submit([task]() { (*task)(); });
 }
 
-void Assembler::outputFile() {
-    if(verbose)
-        std::cout << "Output binary\n";
-    // Output code
-    for(lineNb=0; lineNb<tokens.size(); ++lineNb) {
-        if(opMap.find(tokens[lineNb][0]) == opMap.end()) {
-            Error::error(ERR_OP_UNKNOWN,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-            continue;
-        }
-        u8 opcode = opMap[tokens[lineNb][0]];
-        u16 imm;
-        u8 n = 0, n1 = 0, n2 = 0;
-        switch(opcode) {
-        case NOP: case CLS: case VBLNK: case SND0: case PUSHALL: case POPALL: 
-        case PUSHF: case POPF: case RET:
-            if(tokens[lineNb].size() > 1) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-            }
-            else
-                op_void(buffer,opcode);
-            break;
-        case JMP_I: case JMC: case CALL_I: 
-        case SPR: case SND1: case SND2: case SND3: case PAL_I: {
-            if(tokens[lineNb].size() > 2 || tokens[lineNb].size() < 2) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
+void Assembler::waitPrefetched() {
+    // A source being read queues the ones it includes before it is done,
+    // so look again until none is left
+    for(;;) {
+        pendingReads.clear();
+        {
+            std::lock_guard<std::mutex> lock(prefetchLock);
+            std::map<std::string,std::shared_future<SourceFile*> >::iterator it;
+            for(it = prefetched.begin(); it != prefetched.end(); ++it) {
+                if(it->second.valid() &&
+                   it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                    pendingReads.push_back(it->second);
             }
-            // Overflow check on imm
-            else if(consts.find(tokens[lineNb][1]) != consts.end()) {
-                if(consts[tokens[lineNb][1]] > 0xFFFF) {
-                    Error::error(ERR_NUM_OVERFLOW,files[lineNb],lines[lineNb],tokens[lineNb][1]);
-                    break;
-                }
-                else
-                    imm = consts[tokens[lineNb][1]];
-            }
-            else
-                imm = atoi_t(tokens[lineNb][1]);
-            op_imm(buffer,opcode,imm);
-            break;
         }
-        case Jx: case Cx:
-            if(tokens[lineNb].size() > 3 || tokens[lineNb].size() < 3) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            }
-            // Overflow check on n
-            if(condMap.find(tokens[lineNb][1]) != condMap.end())
-                n = condMap[tokens[lineNb][1]];
-            else {
-                Error::error(ERR_OP_UNKNOWN,files[lineNb],lines[lineNb],"j"+tokens[lineNb][1]+" / c"+tokens[lineNb][1]);
-                break;
-            }
-            // Overflow check on imm
-            if(consts.find(tokens[lineNb][2]) != consts.end()) {
-                if(consts[tokens[lineNb][2]] > 0xFFFF) {
-                    Error::error(ERR_NUM_OVERFLOW,files[lineNb],lines[lineNb],tokens[lineNb][2]);
-                    break;
-                }
-                imm = consts[tokens[lineNb][2]];
-            }
-            else
-                imm = atoi_t(tokens[lineNb][2]);
-            op_n_imm(buffer,opcode,n,imm);
-            break;
-        case SNG:
-            if(tokens[lineNb].size() != 3) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            }
-            // Overflow check on n
-            if(consts.find(tokens[lineNb][1]) != consts.end()) {
-                if(consts[tokens[lineNb][1]] > 0xFF) {
-                    Error::error(ERR_NUM_OVERFLOW,files[lineNb],lines[lineNb],tokens[lineNb][1]);
-                    break;
-                }
-                n = consts[tokens[lineNb][1]];
-            }
-            else
-                n = (u8)atoi_t(tokens[lineNb][1]);
-            // Overflow check on imm
-            if(consts.find(tokens[lineNb][2]) != consts.end()) {
-                if(consts[tokens[lineNb][2]] > 0xFFFF) {
-                    Error::error(ERR_NUM_OVERFLOW,files[lineNb],lines[lineNb],tokens[lineNb][2]);
-                    break;
-                }
-                imm = consts[tokens[lineNb][2]];
-            }
-            else
-                imm = (u16)atoi_t(tokens[lineNb][2]);
-            op_n_imm(buffer,opcode,n,imm);
-            break;
-        case BGC:
-            if(tokens[lineNb].size() > 2 || tokens[lineNb].size() < 2) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            }
-            // Overflow check on n
-            if(consts.find(tokens[lineNb][1]) != consts.end()) {
-                if(consts[tokens[lineNb][1]] > 0xFF) {
-                    Error::error(ERR_NUM_OVERFLOW,files[lineNb],lines[lineNb],tokens[lineNb][1]);
-                    break;
-                }
-                n = consts[tokens[lineNb][1]];
-            }
-            else
-                n = (u8)atoi_t(tokens[lineNb][1]);
-            op_n(buffer,opcode,n);
-            break;
-        case FLIP:
-            if(tokens[lineNb].size() > 3 || tokens[lineNb].size() < 3) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            }
-            // Overflow check on n1
-            if(consts.find(tokens[lineNb][1]) != consts.end()) {
-                if(consts[tokens[lineNb][1]] > 0xFF) {
-                    Error::error(ERR_NUM_OVERFLOW,files[lineNb],lines[lineNb],tokens[lineNb][1]);
-                    break;
-                }
-                n1 = consts[tokens[lineNb][1]];
-            }
-            else
-                n1 = (u8)atoi_t(tokens[lineNb][1]);
-            // Overflow check on n2
-            if(consts.find(tokens[lineNb][2]) != consts.end()) {
-                if(consts[tokens[lineNb][2]] > 0xFF) {
-                    Error::error(ERR_NUM_OVERFLOW,files[lineNb],lines[lineNb],tokens[lineNb][1]);
-                    break;
-                }
-                n2 = consts[tokens[lineNb][1]];
-            }
-            else
-                n2 = (u8)atoi_t(tokens[lineNb][2]);
-            op_n_n(buffer,opcode,n1,n2);
-            break;
-        case CALL_R: case JMP_R: case PUSH: case POP: case PAL_R: case NOT_R: case NEG_R:
-            if(tokens[lineNb].size() > 2 || tokens[lineNb].size() < 2) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-            }
-            else if(regMap.find(tokens[lineNb][1]) == regMap.end()) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-            }
-            else 
-                op_r(buffer,opcode,regMap[tokens[lineNb][1]]);
-            break;
-        case SNP: case RND: case LDI_R: case LDI_SP: case LDM_I: case STM_I: case ADDI: case SUBI: 
-        case MULI: case DIVI: case NOTI: case NEGI: case MODI: case REMI: case CMPI: case ANDI:
-        case TSTI: case ORI: case XORI:
-            if(tokens[lineNb].size() > 3 || tokens[lineNb].size() < 3) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            }
-            // Overflow check on imm
-            if(consts.find(tokens[lineNb][2]) != consts.end()) {
-                if(consts[tokens[lineNb][2]] > 0xFFFF) {
-                    Error::error(ERR_NUM_OVERFLOW,files[lineNb],lines[lineNb],tokens[lineNb][2]);
-                    break;
-                }
-                imm = consts[tokens[lineNb][2]];
-            }
-            else
-                imm = atoi_t(tokens[lineNb][2]);
-            if(regMap.find(tokens[lineNb][1]) == regMap.end() && tokens[lineNb][1] != "sp" && tokens[lineNb][1] != "SP") {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-            }
-            else if(opcode == LDI_SP)
-				op_r_imm(buffer, opcode, 0, imm);
-			else
-                op_r_imm(buffer,opcode,(u8)regMap[tokens[lineNb][1]],imm);
-            break;
-        case SHL_N: case SHR_N: case SAR_N:
-            if(tokens[lineNb].size() > 3 || tokens[lineNb].size() < 3) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            }
-            // Overflow check on n
-            if(consts.find(tokens[lineNb][2]) != consts.end()) {
-                if(consts[tokens[lineNb][2]] > 0xFF) {
-                    Error::error(ERR_NUM_OVERFLOW,files[lineNb],lines[lineNb],tokens[lineNb][2]);
-                    break;
-                }
-                n = consts[tokens[lineNb][2]];
-            }
-            else
-                n = (u8)atoi_t(tokens[lineNb][2]);
-            if(regMap.find(tokens[lineNb][1]) == regMap.end()) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-            }
-            else
-                op_r_n(buffer,opcode,(u8)regMap[tokens[lineNb][1]],n);
-            break;
-        case DRW_I: case JME:
-            if(tokens[lineNb].size() > 4 || tokens[lineNb].size() < 4) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            }
-            // Overflow check on imm
-            if(consts.find(tokens[lineNb][3]) != consts.end()) {
-                if(consts[tokens[lineNb][3]] > 0xFFFF) {
-                    Error::error(ERR_NUM_OVERFLOW,files[lineNb],lines[lineNb],tokens[lineNb][3]);
-                    break;
-                }
-                imm = consts[tokens[lineNb][3]];
-            }
-            else
-                imm = atoi_t(tokens[lineNb][3]);
-            if(regMap.find(tokens[lineNb][1]) == regMap.end() ||
-                    regMap.find(tokens[lineNb][2]) == regMap.end()) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-            }
-            else 
-                op_r_r_imm(buffer,opcode,(u8)regMap[tokens[lineNb][1]],
-                (u8)regMap[tokens[lineNb][2]],imm);
-            break;
-        case ADD_R2: case SUB_R2: case MUL_R2: case DIV_R2: case AND_R2: case OR_R2:
-        case XOR_R2: case SHL_R: case SHR_R: case SAR_R: case LDM_R: case MOV: 
-        case NOT_R2: case NEG_R2: case MOD_R2: case REM_R2: case STM_R: case CMP: case TST:
-            if(tokens[lineNb].size() > 3 || tokens[lineNb].size() < 3) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-            }
-            else if(regMap.find(tokens[lineNb][1]) == regMap.end() ||
-                       regMap.find(tokens[lineNb][2]) == regMap.end()) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-            }
-            else
-                op_r_r(buffer,opcode,(u8)regMap[tokens[lineNb][1]],(u8)regMap[tokens[lineNb][2]]);
-            break;
-        case ADD_R3: case SUB_R3: case MUL_R3: case DIV_R3: case AND_R3: case OR_R3:
-        case XOR_R3: case DRW_R: case MOD_R3: case REM_R3:
-            if(tokens[lineNb].size() > 4 || tokens[lineNb].size() < 4) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-            }
-            else if(regMap.find(tokens[lineNb][1]) == regMap.end() ||
-                    regMap.find(tokens[lineNb][2]) == regMap.end() ||
-                    regMap.find(tokens[lineNb][3]) == regMap.end()) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-            }
-            else 
-                op_r_r_r(buffer,opcode,(u8)regMap[tokens[lineNb][1]],
-                    (u8)regMap[tokens[lineNb][2]],(u8)regMap[tokens[lineNb][3]]);
-            break;
-        case DB: {
-            if(tokens[lineNb].size() == 1) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            }
-            std::vector<u8> vals;
-            for(unsigned j=1; j<tokens[lineNb].size(); ++j) {
-                u16 val;
-                // Overflow check
-                if(consts.find(tokens[lineNb][j]) != consts.end()) 
-                    val = consts[tokens[lineNb][j]];
-                else
-                    val = atoi_t(tokens[lineNb][j]);
-                if(val > 0xFF) {
-                    Error::error(ERR_NUM_OVERFLOW,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                }
-                vals.push_back((u8)val);
-            }
-            db(buffer,vals);
-            break;
-                }
-        case DW: {
-            if(tokens[lineNb].size() == 1) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            }
-            std::vector<u16> vals;
-            for(unsigned j=1; j<tokens[lineNb].size(); ++j) {
-                u16 val;
-                // Overflow check
-                if(consts.find(tokens[lineNb][j]) != consts.end()) 
-                    val = consts[tokens[lineNb][j]];
-                else
-                    val = atoi_t(tokens[lineNb][j]);
-                vals.push_back((u16)val);
-            }
-            dw(buffer,vals);
-            break;
-                 }
-        case DB_STR: {
-            if(tokens[lineNb].size() == 1) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            }
-            tokens[lineNb][1] = tokens[lineNb][1].substr(1,tokens[lineNb][1].length()-2);
-            if(tokens[lineNb][1] == "")
-                Error::error(ERR_STR_INVALID,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-            db(buffer,tokens[lineNb][1]);
-            break;
-                     }
-        case START: {
-            if(tokens[lineNb].size() == 1) {
-                Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            }
-            else if(tokens[lineNb].size() > 2) {
-                Error::error(ERR_TOO_MANY,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            }
-            // Resolve
-            if(consts.find(tokens[lineNb][1]) != consts.end()) 
-                start = consts[tokens[lineNb][1]];
-            else
-                start = atoi_t(tokens[lineNb][1]);
-            break;
-            }
+        if(pendingReads.empty())
+            return;
+        for(size_t i=0; i<pendingReads.size(); ++i)
+            pendingReads[i].wait();
+    }
+}
 
-        default:
-            Error::error(ERR_OP_UNKNOWN,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-            break;
+void Assembler::prefetchIncludes(const SourceFile& file) {
+    line toks;
+    for(unsigned l=0; l<file.lineCount(); ++l) {
+        file.getLine(l,toks);
+        if(toks.size() == 2 && toks[0] == "include")
+            prefetch(std::string(toks[1]));
+    }
+}
+
+SourceFile* Assembler::openSource(std::string_view fn) {
+    if(pool) {
+        std::string name(fn);
+        prefetch(name);
+        std::shared_future<SourceFile*> ready;
+        {
+            std::lock_guard<std::mutex> lock(prefetchLock);
+            ready = prefetched[name];
         }
+        // Time spent waiting for the pool to read it
+        TRACE_SPAN_FILE("wait",fn);
+        return ready.get();
     }
+    TRACE_SPAN_FILE("lex",fn);
+    SourceFile* file = newSource();
+    if(!openFile(*file,fn))
+        return NULL;
+    file->lex();
+    TRACE_ARG("lines",file->lineCount());
+    return file;
+}
+
+SourceFile* Assembler::newSource() {
+    if(nbSources == sources.size())
+        sources.emplace_back();
+    return &sources[nbSources++];
+}
+
+bool Assembler::readImport(ImportBin& imp) {
+    TRACE_SPAN_FILE("importbin",imp.file);
+    TRACE_ARG("line",curLine);
+    TRACE_ARG("offset",imp.offset);
+    TRACE_ARG("size",imp.size);
+    // Binaries imported several times are read once
+    for(unsigned i=0; i<imports.size(); ++i) {
+        if(imports[i].file == imp.file) {
+            imp.file = imports[i].file;
+            imp.data = imports[i].data;
+            return true;
+        }
+    }
+    if(files)
+        return files->read(imp.file,imp.data);
+    // Mapped like a source, and unmapped by reset()
+    SourceFile* bin;
+    {
+        std::lock_guard<std::mutex> lock(prefetchLock);
+        bin = newSource();
+    }
+    imp.file = arena.copy(imp.file);
+    if(!bin->open(imp.file.data()))
+        return false;
+    imp.data = std::string_view(bin->data(),bin->size());
+    return true;
+}
+
+bool Assembler::openFile(SourceFile& file, std::string_view fn) {
+    if(!files)
+        return file.open(fn.data());
+    std::string_view data;
+    if(!files->read(fn,data))
+        return false;
+    file.assign(data);
+    return true;
+}
+
+void Assembler::buildRom() {
+    layoutRom(true);
+}
+
+void Assembler::layoutRom(bool copyImports) {
+    if(verbose)
+        std::cout << "Output binary\n";
+    if(totalBytes > (int)MEM_SIZE) {
+        log.error(ERR_ROM_SIZE,outputFP,0,std::string("All"));
+        return;
+    }
+    unsigned ph = stats.begin("emit",statCounts());
+    // Output code: every statement knows its address, so runs of them
+    // can be written by as many threads
+    unsigned nbChunks = std::min<size_t>(jobs,stmts.size()/EMIT_CHUNK_MIN);
+    if(nbChunks == 0)
+        nbChunks = 1;
+    while(chunks.size() < nbChunks)
+        chunks.push_back(std::unique_ptr<EmitChunk>(new EmitChunk));
+    for(unsigned i=0; i<nbChunks; ++i) {
+        chunks[i]->first = (u32)((u64)stmts.size()*i/nbChunks);
+        chunks[i]->last = (u32)((u64)stmts.size()*(i+1)/nbChunks);
+        chunks[i]->diag.str("");
+        chunks[i]->log.clear();
+    }
+    std::vector<std::future<void> > done;
+    for(unsigned i=1; i<nbChunks; ++i) {
+        std::shared_ptr<std::packaged_task<void()> > task =
+            std::make_shared<std::packaged_task<void()> >(
+                std::bind(&Assembler::emit,this,std::ref(*chunks[i])));
+        done.push_back(task->get_future());
+        pool->submit([task]() { (*task)(); });
+    }
+    emit(*chunks[0]);
+    for(unsigned i=0; i<done.size(); ++i)
+        done[i].wait();
+    // Errors in source order, and the start address set last wins
+    for(unsigned i=0; i<nbChunks; ++i) {
+        log.append(chunks[i]->diag.str(),chunks[i]->log.count());
+        if(chunks[i]->start >= 0)
+            start = chunks[i]->start;
+    }
+    curB = codeBytes;
     if(verbose) {
         std::cout << "Output imports\n";
     }
-    // Output imported binaries
+    // Output imported binaries, straight from their mapping
     for(unsigned i=0; i<imports.size(); ++i) {
-        int size = atoi_t(imports[i][2]);
-        u8* buf = buffer + curB;
-        std::ifstream imp(imports[i][0].c_str(),std::ios::in|std::ios::binary);
-        if(!imp.is_open()) {
-            Error::error(ERR_IO,std::string(""),0,imports[i][0]);
-            break;
+        const ImportBin& imp = imports[i];
+        if(copyImports)
+            memcpy(buffer + curB,imp.data.data() + imp.offset,imp.size);
+        curB += imp.size;
+        if(memo) {
+            BuildInput in;
+            in.path = imp.file;
+            in.whole = false;
+            in.offset = imp.offset;
+            in.length = imp.size;
+            memoInputs.push_back(in);
         }
-        imp.seekg(atoi_t(imports[i][1]));
-        imp.read((char*)buf,size);
-        imp.close();
-        curB += size;
     }
-    // If -z, fill with 0's up to 64K
-    if(zeroFill) {
-        u8* buf = buffer + curB;
+    // If -z, fill with 0's up to 64K; the file gets them by being extended
+    romBytes = curB;
+    if(zeroFill && curB < MEM_SIZE) {
         if(verbose)
             std::cout << "Zero memory up to 64K\n";
-        for(int i=0; i<0x10000-totalBytes; ++i)
-            buf[i] = 0;
+        memset(buffer + curB,0,MEM_SIZE - curB);
+        romBytes = MEM_SIZE;
     }
-    
-    if(Error::output) {
-        std::ofstream out(outputFP.c_str(),std::ios::out|std::ios::binary);
-        if(!out.is_open()) {
-            Error::error(ERR_IO,outputFP,0,std::string("All"));
-            return;
+
+    stats.end(ph,statCounts());
+
+    // Header
+    ph = stats.begin("crc",statCounts());
+    TRACE_SPAN("crc");
+    double frac = modf(version,&version);
+    u8 ver =  ((u8)(version) << 4) | (u8)(frac*10);
+    header.magic = 0x36314843;
+    header.reserved = 0x00;
+    header.spec_ver = ver;
+    header.rom_size = romBytes;
+    crc_t c = crc_init();
+    c = crc32Update(c,buffer,codeBytes);
+    for(unsigned i=0; i<imports.size(); ++i)
+        c = crc32Update(c,(const u8*)imports[i].data.data() + imports[i].offset,imports[i].size);
+    c = crc32Update(c,buffer + curB,romBytes - curB);
+    c = crc_finalize(c);
+    header.start_addr = start;
+    header.crc32_sum = c;
+    stats.end(ph,statCounts());
+}
+
+void Assembler::outputFile() {
+    layoutRom(false);
+    if(!log.failed()) {
+        // Header, code and imported binaries in one go, then zeros up to
+        // the ROM size. Binaries read from disk can be copied from their
+        // files without passing through here.
+        unsigned ph = stats.begin("write",statCounts());
+        TRACE_SPAN_FILE("write",outputFP);
+        u32 headerSize = writeHeader ? sizeof(ch16_header) : 0;
+        romPieces.clear();
+        romPieces.push_back(FilePiece{ &header, headerSize });
+        romPieces.push_back(FilePiece{ buffer, (size_t)codeBytes });
+        for(unsigned i=0; i<imports.size(); ++i) {
+            FilePiece bin = { imports[i].data.data() + imports[i].offset, imports[i].size };
+            if(!files) {
+                bin.file = imports[i].file.data();
+                bin.offset = imports[i].offset;
+            }
+            romPieces.push_back(bin);
         }
-        
-        // Output header
-        if(writeHeader) {
-            double frac = modf(version,&version);
-            u8 ver =  ((u8)(version) << 4) | (u8)(frac*10);
-            ch16_header header;
-            header.magic = 0x36314843;
-            header.reserved = 0x00;
-            header.spec_ver = ver;
-            header.rom_size = curB;
-            crc_t c = crc_init();
-            c = crc_update(c,buffer,curB);
-            c = crc_finalize(c);
-            header.start_addr = start;
-            header.crc32_sum = c;
-            
-            out.write((char*)&header,sizeof(ch16_header));
+        if(!writeFileAtomic(outputFP,romPieces.data(),romPieces.size(),(u64)headerSize + romBytes)) {
+            log.error(ERR_IO,outputFP,0,std::string("All"));
+            stats.end(ph,statCounts());
+            return;
         }
-        
-        out.write((char*)buffer,curB);
-        out.close();
-        
+
         // If -m, output mmap.txt
         if(writeMmap) {
+            TRACE_SPAN_FILE("write","mmap.txt");
             if(verbose)
                 std::cout << "Output mmap.txt\n";
-            std::ofstream mmap("mmap.txt");
-            if(mmap.is_open()) {
-                mmap    << "Label memory mapping:\n"
-                        << "---------------------\n\n";
-                std::map<int,std::string> revConsts;
-                std::map<std::string,int>::iterator it;
-                for(it = consts.begin(); it != consts.end(); ++it)
-                    revConsts[it->second] = it->first;
-                std::map<int,std::string>::iterator itt;
-                for(itt = revConsts.begin(); itt != revConsts.end(); ++itt) {
-                    if(std::find(labelNames.begin(),labelNames.end(),itt->second) !=
-                            labelNames.end()) {
-                        mmap << std::hex << " 0x";
-                        char of = mmap.fill('0');
-                        mmap.width(4); 
-                        mmap << itt->first << " : "  << itt->second << "\n";
-                        mmap.fill(of);
-                    }
-                }
-                mmap << "\n---------------------\n";
-                mmap.close();
+            // Labels sorted by address, then name
+            mapLabels.clear();
+            for(int i=0; i<symbols.size(); ++i) {
+                if(symbols.isLabel(i))
+                    mapLabels.push_back(std::make_pair(symbols[i].value,symbols[i].name));
+            }
+            std::sort(mapLabels.begin(),mapLabels.end());
+            mapText.assign("Label memory mapping:\n"
+                           "---------------------\n\n");
+            for(unsigned i=0; i<mapLabels.size(); ++i) {
+                char addr[16];
+                snprintf(addr,sizeof(addr)," 0x%04x : ",mapLabels[i].first);
+                mapText.append(addr);
+                mapText.append(mapLabels[i].second);
+                mapText.push_back('\n');
+            }
+            mapText.append("\n---------------------\n");
+            FilePiece map = { mapText.data(), mapText.size() };
+            if(!writeFileAtomic("mmap.txt",&map,1))
+                log.error(ERR_IO,std::string("All"),0,std::string("mmap.txt"));
+        }
+        // Remember this build, if it went fine
+        if(memo && !log.failed()) {
+            TRACE_SPAN("memo");
+            for(unsigned i=0; i<filesImp.size(); ++i) {
+                BuildInput in;
+                in.path = filesImp[i];
+                in.whole = true;
+                in.offset = 0;
+                in.length = fileSources[i]->size();
+                in.hash = hash64(fileSources[i]->data(),fileSources[i]->size(),0);
+                memoInputs.push_back(in);
             }
-            else
-                Error::error(ERR_IO,std::string("All"),0,std::string("mmap.txt"));
+            bool hashed = true;
+            for(unsigned i=0; i<memoInputs.size() && hashed; ++i)
+                hashed = memoInputs[i].whole || OutputCache::hashRange(memoInputs[i]);
+            if(hashed)
+                memo->save(memoKey,memoInputs,outputFP,writeMmap);
         }
+        stats.end(ph,statCounts());
     }
 }
 
@@ -652,6 +686,54 @@ void Assembler::noHeader() {
     writeHeader = false;
 }
 
+void Assembler::setJobs(unsigned n) {
+    jobs = n > 0 ? n : 1;
+    delete pool;
+    pool = jobs > 1 ? new ThreadPool(jobs) : NULL;
+}
+
+void Assembler::setErrorStream(std::ostream* os) {
+    log.setStream(os);
+}
+
+bool Assembler::failed() const {
+    return log.failed();
+}
+
+void Assembler::setFileProvider(FileProvider* fp) {
+    files = fp;
+}
+
+void Assembler::useStats(unsigned long long (*allocs)()) {
+    stats.enable(allocs);
+}
+
+void Assembler::useMemo(const char* dir) {
+    delete memo;
+    memo = new OutputCache(dir);
+}
+
+bool Assembler::restoreOutput(char* const* files, int nbFiles) {
+    if(!memo)
+        return false;
+    // Everything that changes the output, except the content of the inputs
+    std::string key(tchip16_ver);
+    key += alignLabels ? " -a" : "";
+    key += zeroFill ? " -z" : "";
+    key += writeHeader ? "" : " -r";
+    key += writeMmap ? " -m" : "";
+    for(int i=0; i<nbFiles; ++i) {
+        key += '\0';
+        key += files[i];
+    }
+    memoKey = hash64(key.data(),key.size(),0);
+    bool hit = memo->restore(memoKey,outputFP,writeMmap);
+    if(verbose)
+        std::cout << "Output cache: " << (hit ? "hit" : "miss") << " ("
+                  << memo->hits() << " hit(s), " << memo->misses() << " miss(es) so far)\n";
+    return hit;
+}
+
 void Assembler::debugOut() {
     std::cout << "\n-- Debug output information:\n\n";
     if(tokens.empty())
@@ -664,10 +746,10 @@ void Assembler::debugOut() {
     }
     // Print out what has been stored
     std::cout << "\nToken array:\n";
-    for(unsigned i=0; i<tokens.size(); ++i) {
-        std::cout << "    " << lines[i] << " : ";
-        for(unsigned j=0; j<tokens[i].size(); j++) {
-            std::cout << "[ " << tokens[i][j] << " ] ";
+    for(unsigned i=0; i<stmts.size(); ++i) {
+        std::cout << "    " << stmts[i].line << " : ";
+        for(unsigned j=0; j<stmts[i].size; j++) {
+            std::cout << "[ " << tokens[stmts[i].tok+j] << " ] ";
         }
         std::cout << std::endl;
     }
@@ -675,616 +757,486 @@ void Assembler::debugOut() {
     std::cout << "\nImport list:\n";
     for(unsigned i=0; i<imports.size(); ++i) {
         std::cout << "    ";
-        for(unsigned j=0; j<imports[i].size(); j++) {
-            std::cout << "[ " << imports[i][j] << " ] ";
-        }
+        std::cout << "[ " << imports[i].file << " ] [ " << imports[i].offset << " ] [ "
+                  << imports[i].size << " ] [ " << imports[i].label << " ]";
         std::cout << std::endl;
     }
-    // Print out consts mappings
+    // Print out consts mappings, in order of definition
     std::cout << "\nConsts mapping:\n";
-    std::map<std::string,int>::iterator it;
-    for(it = consts.begin(); it != consts.end(); it++) {
-        std::cout << "    " << std::left << it->first;
-        std::cout << std::internal << " : " << it->second;
-        if(std::find(labelNames.begin(),labelNames.end(),it->first) != labelNames.end())
+    for(int i=0; i<symbols.size(); ++i) {
+        if(symbols[i].kind == SYM_NONE)
+            continue;
+        std::cout << "    " << std::left << symbols[i].name;
+        std::cout << std::internal << " : " << symbols[i].value;
+        if(symbols.isLabel(i))
             std::cout << std::right << " (label)";
         std::cout << std::endl;
     }
     std::cout << "\n";
 }
 
-// Methods that write instructions to disk 
-
-inline void Assembler::op_void(u8* buf, OPCODE op) {
-    u8* out = buf + curB;
-    out[0] = op;
-    out[1] = 0; out[2] = 0; out[3] = 0;
-    curB += 4;
-}
+// Methods that decode statements
 
-inline void Assembler::op_imm(u8* buf, OPCODE op, u16 imm) {
-    u8* out = buf + curB;
-    out[0] = op;
-    out[1] = 0;
-    out[2] = imm & 0xFF;
-    out[3] = imm >> 8;
-    curB += 4;
+void Assembler::decode(Statement& st) {
+    const std::string_view* tok = tokens.data() + st.tok;
+    unsigned n = st.size - 1;
+    st.arg = operands.size();
+    st.op = selectOpcode(tok,n);
+    switch(st.op) {
+    case OP_NONE:
+        return;
+    case DB_STR:
+        if(n == 0) {
+            stmtError(ERR_OP_ARGS,tok[0]);
+            st.op = OP_NONE;
+        }
+        else if(tok[1].size() <= 2) {
+            stmtError(ERR_STR_INVALID,tok[0]);
+            st.op = OP_NONE;
+        }
+        return;
+    case DB:
+    case DW:
+    case START:
+        if(n == 0) {
+            stmtError(ERR_OP_ARGS,tok[0]);
+            st.op = OP_NONE;
+            return;
+        }
+        else if(st.op == START && n > 1) {
+            stmtError(ERR_TOO_MANY,tok[0]);
+            st.op = OP_NONE;
+            return;
+        }
+        for(unsigned j=1; j<=n; ++j) {
+            Operand o = numberOperand(tok[j]);
+            // Overflow check, -128 to 255; symbols and expressions are
+            // checked once known
+            if(st.op == DB && o.sym == -1 && o.value > 0xFF && !(tok[j][0] == '-' && o.value >= 0xFF80))
+                stmtError(ERR_NUM_OVERFLOW,tok[0]);
+            operands.push_back(o);
+        }
+        return;
+    default:
+        break;
+    }
+    const OpcodeLayout& layout = formatTable[st.op];
+    if(n != layout.nargs) {
+        stmtError(ERR_OP_ARGS,tok[0]);
+        st.op = OP_NONE;
+        return;
+    }
+    for(unsigned i=0; i<n; ++i) {
+        int arg = layout.args[i];
+        Operand o;
+        o.value = 0;
+        o.sym = -1;
+        if(isRegisterArg(arg)) {
+            int reg = findRegister(tok[i+1]);
+            if(reg < 0 && !(arg == ARG_SP && sameName(tok[i+1],"sp"))) {
+                stmtError(ERR_OP_ARGS,tok[0]);
+                break;
+            }
+            o.value = reg < 0 ? 0 : reg;
+        }
+        else if(arg == ARG_COND) {
+            int cond = findCondition(tok[i+1]);
+            if(cond < 0) {
+                std::string name(tok[i+1]);
+                stmtError(ERR_OP_UNKNOWN,"j"+name+" / c"+name);
+                break;
+            }
+            o.value = cond;
+        }
+        else {
+            o = numberOperand(tok[i+1]);
+            // Narrower than a byte (flip), larger literals are truncated
+            if(o.sym == -1 && argLimit(arg) == 1 && o.value > 1) {
+                stmtError(ERR_OP_ARGS,"FLIP");
+                break;
+            }
+        }
+        operands.push_back(o);
+    }
+    // Drop what was decoded of a bad instruction
+    if(operands.size() != st.arg + n) {
+        operands.resize(st.arg);
+        st.op = OP_NONE;
+    }
 }
 
-inline void Assembler::op_n_imm(u8* buf, OPCODE op, u8 n, u16 imm) {
-    u8* out = buf + curB;
-    out[0] = op;
-    out[1] = n;    
-    out[2] = imm & 0xFF;
-    out[3] = imm >> 8;
-    curB += 4;
+// Register operand i selects the register form of a mnemonic
+static inline bool regOperand(const std::string_view* tok, unsigned n, unsigned i) {
+    return i <= n && findRegister(tok[i]) >= 0;
 }
 
-inline void Assembler::op_n(u8* buf, OPCODE op, u8 n) {
-    u8* out = buf + curB;
-    out[0] = op;
-    out[1] = 0;
-    out[2] = n; out[3] = 0;
-    curB += 4;
+OPCODE Assembler::selectOpcode(const std::string_view* tok, unsigned n) {
+    int op = findOpcode(tok[0]);
+    if(op >= 0)
+        return op;
+    switch(findMnemonic(tok[0])) {
+    // Register or immediate
+    case drw:   return regOperand(tok,n,3) ? DRW_R : DRW_I;
+    case jmp:   return regOperand(tok,n,1) ? JMP_R : JMP_I;
+    case call:  return regOperand(tok,n,1) ? CALL_R : CALL_I;
+    case ldm:   return regOperand(tok,n,2) ? LDM_R : LDM_I;
+    case stm:   return regOperand(tok,n,2) ? STM_R : STM_I;
+    case sal:
+    case shl:   return regOperand(tok,n,2) ? SHL_R : SHL_N;
+    case sar:   return regOperand(tok,n,2) ? SAR_R : SAR_N;
+    case shr:   return regOperand(tok,n,2) ? SHR_R : SHR_N;
+    case pal:   return regOperand(tok,n,1) ? PAL_R : PAL_I;
+    case ldi:
+        if(regOperand(tok,n,1))
+            return LDI_R;
+        else if(n > 0 && sameName(tok[1],"sp"))
+            return LDI_SP;
+        stmtError(ERR_OP_ARGS,n > 0 ? tok[1] : tok[0]);
+        return OP_NONE;
+    // Two or three registers
+    case add:   return n == 3 ? ADD_R3 : ADD_R2;
+    case sub:   return n == 3 ? SUB_R3 : SUB_R2;
+    case _and:  return n == 3 ? AND_R3 : AND_R2;
+    case _or:   return n == 3 ? OR_R3 : OR_R2;
+    case _xor:  return n == 3 ? XOR_R3 : XOR_R2;
+    case mul:   return n == 3 ? MUL_R3 : MUL_R2;
+    case _div:  return n == 3 ? DIV_R3 : DIV_R2;
+    case mod:   return n == 3 ? MOD_R3 : MOD_R2;
+    case rem:   return n == 3 ? REM_R3 : REM_R2;
+    // One or two registers
+    case _not:  return n == 2 ? NOT_R2 : NOT_R;
+    case neg:   return n == 2 ? NEG_R2 : NEG_R;
+    case _db:
+        if(n > 0 && tok[1][0] == '"') {
+            if(tok[n][tok[n].size()-1] == '"')
+                return DB_STR;
+            stmtError(ERR_STR_INVALID,tok[0]);
+            return OP_NONE;
+        }
+        return DB;
+    default:
+        stmtError(ERR_OP_UNKNOWN,tok[0]);
+        return OP_NONE;
+    }
 }
 
-inline void Assembler::op_n_n(u8* buf, OPCODE op,u8 n1,u8 n2) {
-    u8* out = buf + curB;
-    out[0] = op;
-    out[1] = 0; out[2] = 0;
-    // Do some error checking
-    if(n1 == 0) {
-        if(n2 == 0)
-            out[3] = 0;
-        else if(n2 == 1)
-            out[3] = 1;
-        else
-            Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],std::string("FLIP"));
+Operand Assembler::numberOperand(std::string_view tok) {
+    Operand o;
+    // Names cannot start like a number; anything else is looked up once
+    // all labels are known, and read as a number if it isn't one.
+    // Expressions are kept as text, and worked out at the same time.
+    if(isExpression(tok)) {
+        o.value = 0;
+        o.sym = EXPR_OPERAND;
     }
-    else if(n1 == 1) {
-        if(n2 == 0)
-            out[3] = 2;
-        else if(n2 == 1)
-            out[3] = 3;
-        else
-            Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],std::string("FLIP"));
+    else if(startsNumber(tok)) {
+        o.value = atoi_t(tok);
+        o.sym = -1;
     }
-    else
-        Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],std::string("FLIP"));
+    else {
+        o.value = 0;
+        o.sym = symbols.intern(tok);
+    }
+    return o;
+}
 
-    curB += 4;
+// Methods that write instructions to disk 
+
+void Assembler::emit(EmitChunk& c) {
+    TRACE_SPAN("emit");
+    TRACE_ARG("first",c.first);
+    TRACE_ARG("statements",c.last - c.first);
+    // Errors go to the chunk, to be printed in order
+    c.start = -1;
+    for(u32 i=c.first; i<c.last; ++i) {
+        const Statement& st = stmts[i];
+        u8* out = buffer + st.addr;
+        switch(st.op) {
+        case OP_NONE:
+            // Reported by decode
+            break;
+        case DB:
+            db(i,out,c.log);
+            break;
+        case DW:
+            dw(i,out,c.log);
+            break;
+        case DB_STR: {
+            std::string_view str = tokens[st.tok+1];
+            db(out,str.substr(1,str.size()-2));
+            break;
+                     }
+        case START:
+            c.start = operandValue(operands[st.arg],i,0,c.log);
+            break;
+        default:
+            encode(i,out,c.log);
+            break;
+        }
+    }
 }
 
-inline void Assembler::op_r(u8* buf, OPCODE op, u8 r) {
-    u8* out = buf + curB;
-    out[0] = op;
-    out[1] = r;
-    out[2] = 0; out[3] = 0;
-    curB += 4;
+u16 Assembler::operandValue(const Operand& o, unsigned stmt, unsigned i, ErrorLog& errs) {
+    if(o.sym == EXPR_OPERAND) {
+        const Statement& st = stmts[stmt];
+        return (u16)exprValue(tokens[st.tok+1+i],st.addr,stmt,tokens[st.tok],errs);
+    }
+    if(o.sym < 0)
+        return o.value;
+    const Symbol& sym = symbols[o.sym];
+    // Never defined, eg a number like "ffh"
+    if(sym.kind == SYM_NONE)
+        return atoi_t(sym.name,stmt,errs);
+    return sym.value;
 }
 
-inline void Assembler::op_r_imm(u8* buf, OPCODE op,u8 r,u16 imm) {
-    u8* out = buf + curB;
-    out[0] = op;
-    out[1] = r;
-    out[2] = imm & 0xFF;
-    out[3] = imm >> 8;
-    curB += 4;
+u16 Assembler::byteOperand(const Operand& o, unsigned stmt, unsigned i, ErrorLog& errs, bool& fits) {
+    if(o.sym == EXPR_OPERAND) {
+        // Checked before it is cut to 16 bits, which would lose the sign
+        const Statement& st = stmts[stmt];
+        int v = exprValue(tokens[st.tok+1+i],st.addr,stmt,tokens[st.tok],errs);
+        fits = v >= -128 && v <= 0xFF;
+        return (u16)v;
+    }
+    u16 v = operandValue(o,stmt,i,errs);
+    // Symbol values are unsigned
+    fits = o.sym < 0 || v <= 0xFF;
+    return v;
 }
 
-inline void Assembler::op_r_n(u8* buf, OPCODE op,u8 r,u8 n) {
-    u8* out = buf + curB;
-    out[0] = op;
-    out[1] = r;
-    out[2] = n; out[3] = 0;
-    curB += 4;
+void Assembler::encode(unsigned stmt, u8* out, ErrorLog& errs) {
+    const Statement& st = stmts[stmt];
+    const OpcodeLayout& layout = formatTable[st.op];
+    const Operand* arg = operands.data() + st.arg;
+    u16 vals[3] = { 0, 0, 0 };
+    for(int i=0; i<layout.nargs; ++i) {
+        int sym = arg[i].sym;
+        bool fits = true;
+        if(layout.args[i] == ARG_HHLL)
+            vals[i] = operandValue(arg[i],stmt,i,errs);
+        else
+            vals[i] = byteOperand(arg[i],stmt,i,errs,fits);
+        if(sym == -1 || (sym >= 0 && symbols[sym].kind == SYM_NONE))
+            continue;
+        // Overflow check, words are checked as they are worked out
+        if(!fits) {
+            stmtError(stmt,ERR_NUM_OVERFLOW,sym >= 0 ? symbols[sym].name : tokens[st.tok+1+i],errs);
+            return;
+        }
+        // Narrower than a byte (flip)
+        if(vals[i] > argLimit(layout.args[i]) && argLimit(layout.args[i]) == 1) {
+            stmtError(stmt,ERR_OP_ARGS,"FLIP",errs);
+            return;
+        }
+    }
+    encodeOp(out,st.op,layout,vals);
 }
 
-inline void Assembler::op_r_r(u8* buf, OPCODE op, u8 r1, u8 r2) {
-    u8* out = buf + curB;
-    out[0] = op;
-    out[1] = (r2 << 4) | r1;
-    out[2] = 0; out[3] = 0;
-    curB += 4;
+void Assembler::db(unsigned stmt, u8* out, ErrorLog& errs) {
+    const Statement& st = stmts[stmt];
+    const Operand* arg = operands.data() + st.arg;
+    unsigned n = st.size - 1;
+    for(unsigned i=0; i<n; ++i) {
+        bool fits;
+        u16 val = byteOperand(arg[i],stmt,i,errs,fits);
+        if(!fits)
+            stmtError(stmt,ERR_NUM_OVERFLOW,tokens[st.tok],errs);
+        out[i] = (u8)val;
+    }
+    pad(out,n);
 }
 
-inline void Assembler::op_r_r_imm(u8* buf, OPCODE op, u8 r1,u8 r2,u16 imm) {
-    u8* out = buf + curB;
-    out[0] = op;
-    out[1] = (r2 << 4) | r1;
-    out[2] = imm & 0xFF;
-    out[3] = imm >> 8;
-    curB += 4;
+void Assembler::dw(unsigned stmt, u8* out, ErrorLog& errs) {
+    const Statement& st = stmts[stmt];
+    const Operand* arg = operands.data() + st.arg;
+    unsigned n = st.size - 1;
+    // Little endian, whatever the host is
+    for(unsigned i=0; i<n; ++i) {
+        u16 val = operandValue(arg[i],stmt,i,errs);
+        out[2*i] = val & 0xFF;
+        out[2*i+1] = val >> 8;
+    }
+    pad(out,2*n);
 }
 
-inline void Assembler::op_r_r_r(u8* buf, OPCODE op, u8 r1,u8 r2,u8 r3) {
-    u8* out = buf + curB;
-    out[0] = op;
-    out[1] = (r2 << 4) | r1;
-    out[2] = r3;
-    out[3] = 0;
-    curB += 4;
+void Assembler::db(u8* out, std::string_view str) {
+    for(unsigned i=0; i<str.size(); ++i)
+        out[i] = str[i];
+    pad(out,str.size());
 }
 
-void Assembler::db(u8* buf, std::vector<u8>& bytes) {
-    u8* out = buf + curB;
-    for(unsigned i=0; i<bytes.size(); ++i) {
-        (*out++) = bytes[i];
-    }
-    curB += bytes.size();
-    if(alignLabels && (bytes.size() % 4) != 0) {
-        char pad = 0x00;
-        for(unsigned i=0; i<4-(bytes.size()%4); ++i) {
-            (*out++) = pad;
-            ++curB;
-        }
+void Assembler::pad(u8* out, u32 size) {
+    if(alignLabels) {
+        for(u32 i=size; i%4 != 0; ++i)
+            out[i] = 0x00;
     }
 }
 
-void Assembler::dw(u8* buf, std::vector<u16>& words) {
-    u16* out = (u16*)((u8*)(buf + curB));
-    for(unsigned i=0; i<words.size(); ++i) {
-        (*out++) = words[i];
-    }
-    curB += words.size()*2;
-    u8* out_ = (u8*)out;
-    if(alignLabels && (words.size() % 4) != 0) {
-        char pad = 0x00;
-        for(unsigned i=0; i<4-(words.size()%4); ++i) {
-            (*out_++) = pad;
-            ++curB;
-        }
-    }
+void Assembler::stmtError(ERROR code, std::string_view obj) {
+    stmtError(lineNb,code,obj,log);
 }
 
-void Assembler::db(u8* buf, std::string& str) {
-    u8* out = buf + curB;
-    for(unsigned i=0; i<str.size(); ++i) {
-        (*out++) = str[i];
-    }
-    curB += str.size();
-    if(alignLabels && (str.size() % 4) != 0) {
-        char pad = 0x00;
-        for(unsigned i=0; i<4-(str.size()%4); ++i) {
-            (*out++) = pad;
-            ++curB;
-        }
-    }
+void Assembler::stmtError(unsigned stmt, ERROR code, std::string_view obj, ErrorLog& errs) {
+    if(stmt < stmts.size())
+        errs.error(code,filesImp[stmts[stmt].file],stmts[stmt].line,obj);
+    else if(curFile < (int)filesImp.size())
+        errs.error(code,filesImp[curFile],curLine,obj);
+    else
+        errs.error(code,"",0,obj);
 }
 
-u16 Assembler::atoi_t(std::string str)
+u16 Assembler::atoi_t(std::string_view num) {
+    return atoi_t(num,lineNb,log);
+}
+
+u16 Assembler::atoi_t(std::string_view num, unsigned stmt, ErrorLog& errs)
 {
-    if(str.size() == 0)
+    if(num.size() == 0)
         return 0;
-    std::transform(str.begin(),str.end(),str.begin(),::tolower);
-    u16 val = 0, mul = 1;
-    // If number is hexadecimal
-    // Notation: $NN, #NN, 0xNN, NNh
-    if(str.size() > 1 && (
-        (str[0] == '#') ||
-        (str[0] == '$') ||
-        (str[0] == '0' && str[1] == 'x') || 
-        (str[str.size()-1] == 'h'))) {
-        
-        if(str[0] == '#' || str[0] == '$')
-            str = str.substr(1,str.size());
-        else if(str[0] == '0' && str[1] == 'x')
-            str = str.substr(2,str.size());
-        else if(str[str.size()-1] == 'h')
-            str = str.substr(0,str.size()-1);
-        // Number is bigger than 16-bit, not allowed
-        if(str.size() > 4)
-            Error::error(ERR_NUM_OVERFLOW,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-        for(int i=str.size()-1; i>=0; --i) {
-            char c = str[i];
-            u16 v = 0;
-            if(c >= 0x30 && c <= 0x39)
-                v = (u16)(c - 0x30);
-            else if(c >= 0x61 && c <= 0x66)
-                v = (u16)(c - 0x61 + 10);
-            else {
-                Error::error(ERR_NAN,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                return 0;
-            }
-            val += mul * v;
-            mul *= 16;
-        }
+    u16 val;
+    switch(parseNumber(num,val)) {
+    case NUM_NAN:
+        stmtError(stmt,ERR_NAN,num,errs);
+        return 0;
+    case NUM_OVERFLOW:
+        // Errors name the mnemonic, or the number itself outside of code
+        stmtError(stmt,ERR_NUM_OVERFLOW,stmt < stmts.size() ? tokens[stmts[stmt].tok] : num,errs);
+        return val;
+    default:
         return val;
-    }
-    // Otherwise, assume it's decimal
-    else {
-        int start = 0;
-        if(str[0] == '-')
-            ++start;
-        // Number does not fit than 16-bits
-        if(str.size() - start > 5)
-            Error::error(ERR_NUM_OVERFLOW,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-        for(int i=str.size()-1; i>=start; --i) {
-            char c = str[i];
-            if(c >= 0x30 && c <= 0x39)
-                val += mul * (u16)(c - 0x30);
-            else {
-                Error::error(ERR_NAN,files[lineNb],lines[lineNb],str);
-                return 0;
-            }
-            mul *= 10;
-        }
-        return start ? (~val+1) : val;
     }
 }
 
-void Assembler::initMaps() {
-    // Tedious part: insert all opcodes...
-    opMap["nop"] = NOP;
-    opMap["cls"] = CLS;
-    opMap["vblnk"] = VBLNK;
-    opMap["bgc"] = BGC;
-    opMap["spr"] = SPR;
-    opMap["drw_r"] = DRW_R;
-    opMap["drw_i"] = DRW_I;
-    opMap["rnd"] = RND;
-    opMap["flip"] = FLIP;
-    opMap["snd0"] = SND0;
-    opMap["snd1"] = SND1;
-    opMap["snd2"] = SND2;
-    opMap["snd3"] = SND3;
-    opMap["snp"] = SNP;
-    opMap["sng"] = SNG;
-    opMap["jmp_i"] = JMP_I;
-    opMap["jmp_r"] = JMP_R;
-    opMap["jmc"] = JMC;
-    opMap["jx"] = Jx;
-    opMap["jme"] = JME;
-    opMap["call_i"] = CALL_I;
-    opMap["call_r"] = CALL_R;
-    opMap["cx"] = Cx;
-    opMap["ret"] = RET;
-    opMap["ldi_r"] = LDI_R;
-    opMap["ldi_sp"] = LDI_SP;
-    opMap["ldm_i"] = LDM_I;
-    opMap["ldm_r"] = LDM_R;
-    opMap["mov"] = MOV;
-    opMap["stm_i"] = STM_I;
-    opMap["stm_r"] = STM_R;
-    opMap["addi"] = ADDI;
-    opMap["add_r2"] = ADD_R2;
-    opMap["add_r3"] = ADD_R3;
-    opMap["subi"] = SUBI;
-    opMap["sub_r2"] = SUB_R2;
-    opMap["sub_r3"] = SUB_R3;
-    opMap["cmpi"] = CMPI;
-    opMap["cmp"] = CMP;
-    opMap["andi"] = ANDI;
-    opMap["and_r2"] = AND_R2;
-    opMap["and_r3"] = AND_R3;
-    opMap["tsti"] = TSTI;
-    opMap["tst"] = TST;
-    opMap["ori"] = ORI;
-    opMap["or_r2"] = OR_R2;
-    opMap["or_r3"] = OR_R3;
-    opMap["xori"] = XORI;
-    opMap["xor_r2"] = XOR_R2;
-    opMap["xor_r3"] = XOR_R3;
-    opMap["muli"] = MULI;
-    opMap["mul_r2"] = MUL_R2;
-    opMap["mul_r3"] = MUL_R3;
-    opMap["divi"] = DIVI;
-    opMap["div_r2"] = DIV_R2;
-    opMap["div_r3"] = DIV_R3;
-    opMap["modi"] = MODI;
-    opMap["mod_r2"] = MOD_R2;
-    opMap["mod_r3"] = MOD_R3;
-    opMap["remi"] = REMI;
-    opMap["rem_r2"] = REM_R2;
-    opMap["rem_r3"] = REM_R3;
-    opMap["shl_n"] = SHL_N;
-    opMap["sal_n"] = SHL_N;
-    opMap["shr_n"] = SHR_N;
-    opMap["sar_n"] = SAR_N;
-    opMap["shl_r"] = SHL_R;
-    opMap["sal_r"] = SHL_R;
-    opMap["shr_r"] = SHR_R;
-    opMap["sar_r"] = SAR_R;
-    opMap["push"] = PUSH;
-    opMap["pop"] = POP;
-    opMap["pushall"] = PUSHALL;
-    opMap["popall"] = POPALL;
-    opMap["pushf"] = PUSHF;
-    opMap["popf"] = POPF;
-    opMap["pal_i"] = PAL_I;
-    opMap["pal_r"] = PAL_R;
-    opMap["noti"] = NOTI;
-    opMap["not_r"] = NOT_R;
-    opMap["not_r2"] = NOT_R2;
-    opMap["negi"] = NEGI;
-    opMap["neg_r"] = NEG_R;
-    opMap["neg_r2"] = NEG_R2;
-    opMap["db_n"] = DB;
-    opMap["db_str"] = DB_STR;
-    opMap["dw"] = DW;
-    opMap["start"] = START;
-    // Register mapping
-    regMap["r0"] = 0x0; regMap["R0"] = 0x0;
-    regMap["r1"] = 0x1; regMap["R1"] = 0x1;
-    regMap["r2"] = 0x2; regMap["R2"] = 0x2;
-    regMap["r3"] = 0x3; regMap["R3"] = 0x3;
-    regMap["r4"] = 0x4; regMap["R4"] = 0x4;
-    regMap["r5"] = 0x5; regMap["R5"] = 0x5;
-    regMap["r6"] = 0x6; regMap["R6"] = 0x6;
-    regMap["r7"] = 0x7; regMap["R7"] = 0x7;
-    regMap["r8"] = 0x8; regMap["R8"] = 0x8;
-    regMap["r9"] = 0x9; regMap["R9"] = 0x9;
-    regMap["ra"] = 0xA; regMap["RA"] = 0xA;
-    regMap["rb"] = 0xB; regMap["RB"] = 0xB;
-    regMap["rc"] = 0xC; regMap["RC"] = 0xC;
-    regMap["rd"] = 0xD; regMap["RD"] = 0xD;
-    regMap["re"] = 0xE; regMap["RE"] = 0xE;
-    regMap["rf"] = 0xF; regMap["RF"] = 0xF;
-    regMap["r10"] = 0xA; regMap["R10"] = 0xA;
-    regMap["r11"] = 0xB; regMap["R11"] = 0xB;
-    regMap["r12"] = 0xC; regMap["R12"] = 0xC;
-    regMap["r13"] = 0xD; regMap["R13"] = 0xD;
-    regMap["r14"] = 0xE; regMap["R14"] = 0xE;
-    regMap["r15"] = 0xF; regMap["R15"] = 0xF;
-    // Condition modes in branching operations
-    condMap["z"] = 0x0;
-    condMap["mz"] = 0x0;
-    condMap["nz"] = 0x1;
-    condMap["n"] = 0x2;
-    condMap["nn"] = 0x3;
-    condMap["p"] = 0x4;
-    condMap["o"] = 0x5;
-    condMap["no"] = 0x6;
-    condMap["a"] = 0x7;
-    condMap["ae"] = 0x8;
-    condMap["nc"] = 0x8;
-    condMap["b"] = 0x9;
-    condMap["c"] = 0x9;
-    condMap["mc"] = 0x9;
-    condMap["be"] = 0xA;
-    condMap["g"] = 0xB;
-    condMap["ge"] = 0xC;
-    condMap["l"] = 0xD;
-    condMap["le"] = 0xE;
-    // Mnemonics that need fixing (multiple addressing modes)
-    mnemMap["drw"] = drw;
-    mnemMap["jmp"] = jmp;
-    mnemMap["call"] = call;
-    mnemMap["ldi"] = ldi;
-    mnemMap["ldm"] = ldm;
-    mnemMap["stm"] = stm;
-    mnemMap["add"] = add;
-    mnemMap["sub"] = sub;
-    mnemMap["and"] = _and;
-    mnemMap["or"] = _or;
-    mnemMap["xor"] = _xor;
-    mnemMap["mul"] = mul;
-    mnemMap["div"] = _div;
-    mnemMap["mod"] = mod; 
-    mnemMap["rem"] = rem; 
-    mnemMap["shl"] = shl;
-    mnemMap["sal"] = sal;
-    mnemMap["shr"] = shr;
-    mnemMap["sar"] = sar;
-    mnemMap["pal"] = pal;
-    mnemMap["not"] = _not;
-    mnemMap["neg"] = neg; 
-    mnemMap["db"] = _db;
+void Assembler::deferConst(std::string_view name, std::string_view value, bool length, int file, int line) {
+    DeferredConst dc;
+    dc.sym = symbols.find(name);
+    dc.ref = length ? symbols.intern(value) : -1;
+    dc.length = length;
+    dc.expr = value;
+    dc.addr = totalBytes;
+    dc.firstDep = constDeps.size();
+    // Malformed expressions are reported once worked out
+    if(!length) {
+        SymbolRefs refs(symbols,constDeps);
+        scanExpression(value,refs);
+        // Or a name holding '-', see exprValue
+        if(value.find('-') != std::string_view::npos && hyphenName(value))
+            constDeps.push_back(symbols.intern(value));
+    }
+    dc.nbDeps = constDeps.size() - dc.firstDep;
+    dc.file = file;
+    dc.line = line;
+    deferred.push_back(dc);
+}
 
+u16 Assembler::deferredValue(const DeferredConst& dc) {
+    if(dc.length) {
+        const Symbol& ref = symbols[dc.ref];
+        if(ref.kind == SYM_NONE || dc.ref >= (int)strLens.size() || strLens[dc.ref] < 0) {
+            log.error(ERR_NUM_NONE,filesImp[dc.file],dc.line,ref.name);
+            return 0;
+        }
+        return strLens[dc.ref];
+    }
+    // Reported at the equ, outside of any statement
+    curFile = dc.file;
+    curLine = dc.line;
+    return (u16)exprValue(dc.expr,dc.addr,stmts.size(),symbols[dc.sym].name,log);
 }
 
-void Assembler::resolveConsts() {
-    for(unresMap::iterator it=unresConsts.begin();
-        it!=unresConsts.end(); ++it) {
-            // if the string is declared
-            if(consts.find(it->second.second) != consts.end()) {
-                int line = 0;
-                for(unsigned int i=0; i<lines.size(); ++i) {
-                    if(lines[i] == stringLines[it->second.second])
-                        line = i;
-                }
-                std::string str(tokens[line][1]);
-                // Add the string length to known consts
-                consts.insert(std::make_pair(it->first,str.substr(1,str.length()-2).length()));
-            }
-            else
-                Error::error(ERR_NUM_NONE,outputFP,it->second.first,it->second.second);
+int Assembler::exprValue(std::string_view expr, u32 here, unsigned stmt, std::string_view name,
+                         ErrorLog& errs) {
+    // A name may hold '-': my-label is the label, if there is one, rather
+    // than my minus label
+    int id = symbols.find(expr);
+    if(id >= 0 && symbols[id].kind != SYM_NONE)
+        return symbols[id].value;
+    SymbolValues names(symbols);
+    long long v = 0;
+    std::string_view at;
+    switch(evalExpression(expr,here,names,v,at)) {
+    case EXPR_OK:
+        return (int)v;
+    case EXPR_NAN:
+        stmtError(stmt,ERR_NAN,at,errs);
+        break;
+    case EXPR_DIV_ZERO:
+        stmtError(stmt,ERR_DIV_ZERO,expr,errs);
+        break;
+    case EXPR_OVERFLOW:
+        stmtError(stmt,ERR_NUM_OVERFLOW,name,errs);
+        break;
+    case EXPR_LENGTH:
+        stmtError(stmt,ERR_EXPR_LENGTH,at,errs);
+        break;
+    default:
+        stmtError(stmt,ERR_EXPR,expr,errs);
+        break;
     }
+    return 0;
 }
 
-void Assembler::fixOps() {
-    for(lineNb=0; lineNb<tokens.size(); ++lineNb) {
-        // Ensure all opcodes are lowercase to avoid side-effects
-        std::transform(tokens[lineNb][0].begin(),tokens[lineNb][0].begin(),
-            tokens[lineNb][0].begin(),::tolower);
-        if(opMap.find(tokens[lineNb][0]) == opMap.end()) {
-            switch(mnemMap[tokens[lineNb][0]]) {
-            case drw:
-                if(tokens[lineNb].size() != 4)
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                if(regMap.find(tokens[lineNb][3]) != regMap.end())
-                    tokens[lineNb][0] = "drw_r";
-                else
-                    tokens[lineNb][0] = "drw_i";
-                break;
-            case jmp:
-                if(tokens[lineNb].size() != 2)
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                if(regMap.find(tokens[lineNb][1]) != regMap.end())
-                    tokens[lineNb][0] = "jmp_r";
-                else
-                    tokens[lineNb][0] = "jmp_i";
-                break;
-            case call:
-                if(tokens[lineNb].size() != 2)
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                if(regMap.find(tokens[lineNb][1]) != regMap.end())
-                    tokens[lineNb][0] = "call_r";
-                else
-                    tokens[lineNb][0] = "call_i";
-                break;
-            case ldi:
-                if(tokens[lineNb].size() != 3)
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                if(tokens[lineNb][1][0] == 'r' || tokens[lineNb][1][0] == 'R')
-                    tokens[lineNb][0] = "ldi_r";
-                else if(tokens[lineNb][1] == "sp" || tokens[lineNb][1] == "SP")
-                    tokens[lineNb][0] = "ldi_sp";
-                else
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][1]);
-                break;
-            case ldm:
-                if(tokens[lineNb].size() != 3)
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                if(regMap.find(tokens[lineNb][2]) != regMap.end())
-                    tokens[lineNb][0] = "ldm_r";
-                else
-                    tokens[lineNb][0] = "ldm_i";
-                break;
-            case stm:
-                if(tokens[lineNb].size() != 3)
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                if(regMap.find(tokens[lineNb][2]) != regMap.end())
-                    tokens[lineNb][0] = "stm_r";
-                else
-                    tokens[lineNb][0] = "stm_i";
-                break;
-            case add:
-                if(tokens[lineNb].size() == 3)
-                    tokens[lineNb][0] = "add_r2";
-                else if(tokens[lineNb].size() == 4)
-                    tokens[lineNb][0] = "add_r3";
-                else
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            case sub:
-                if(tokens[lineNb].size() == 3)
-                    tokens[lineNb][0] = "sub_r2";
-                else if(tokens[lineNb].size() == 4)
-                    tokens[lineNb][0] = "sub_r3";
-                else
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            case _and:
-                if(tokens[lineNb].size() == 3)
-                    tokens[lineNb][0] = "and_r2";
-                else if(tokens[lineNb].size() == 4)
-                    tokens[lineNb][0] = "and_r3";
-                else
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            case _or:
-                if(tokens[lineNb].size() == 3)
-                    tokens[lineNb][0] = "or_r2";
-                else if(tokens[lineNb].size() == 4)
-                    tokens[lineNb][0] = "or_r3";
-                else
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            case _xor:
-                if(tokens[lineNb].size() == 3)
-                    tokens[lineNb][0] = "xor_r2";
-                else if(tokens[lineNb].size() == 4)
-                    tokens[lineNb][0] = "xor_r3";
-                else
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            case mul:
-                if(tokens[lineNb].size() == 3)
-                    tokens[lineNb][0] = "mul_r2";
-                else if(tokens[lineNb].size() == 4)
-                    tokens[lineNb][0] = "mul_r3";
-                else
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            case _div:
-                if(tokens[lineNb].size() == 3)
-                    tokens[lineNb][0] = "div_r2";
-                else if(tokens[lineNb].size() == 4)
-                    tokens[lineNb][0] = "div_r3";
-                else
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            case mod:
-                if(tokens[lineNb].size() == 3)
-                    tokens[lineNb][0] = "mod_r2";
-                else if(tokens[lineNb].size() == 4)
-                    tokens[lineNb][0] = "mod_r3";
-                else
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            case rem:
-                if(tokens[lineNb].size() == 3)
-                    tokens[lineNb][0] = "rem_r2";
-                else if(tokens[lineNb].size() == 4)
-                    tokens[lineNb][0] = "rem_r3";
-                else
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            case sal:
-            case shl:
-                if(tokens[lineNb].size() != 3)
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                if(regMap.find(tokens[lineNb][2]) != regMap.end())
-                    tokens[lineNb][0] = "shl_r";
-                else
-                    tokens[lineNb][0] = "shl_n";
-                break;
-            case sar:
-                if(tokens[lineNb].size() != 3)
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                if(regMap.find(tokens[lineNb][2]) != regMap.end())
-                    tokens[lineNb][0] = "sar_r";
-                else
-                    tokens[lineNb][0] = "sar_n";
-                break;
-            case shr:
-                if(tokens[lineNb].size() != 3)
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                if(regMap.find(tokens[lineNb][2]) != regMap.end())
-                    tokens[lineNb][0] = "shr_r";
-                else
-                    tokens[lineNb][0] = "shr_n";
-                break;
-            case pal:
-                if(tokens[lineNb].size() != 2)
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                if(regMap.find(tokens[lineNb][1]) != regMap.end())
-                    tokens[lineNb][0] = "pal_r";
-                else
-                    tokens[lineNb][0] = "pal_i";
-                break;
-            case _not:
-                if(tokens[lineNb].size() == 2)
-                    tokens[lineNb][0] = "not_r";
-                else if(tokens[lineNb].size() == 3)
-                    tokens[lineNb][0] = "not_r2";
-                else
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            case neg:
-                if(tokens[lineNb].size() == 2)
-                    tokens[lineNb][0] = "neg_r";
-                else if(tokens[lineNb].size() == 3)
-                    tokens[lineNb][0] = "neg_r2";
-                else
-                    Error::error(ERR_OP_ARGS,files[lineNb],lines[lineNb],tokens[lineNb][0]);
-                break;
-            case _db:
-                if(tokens[lineNb][1][0] == '"') {
-                    int lastword = tokens[lineNb].size()-1;
-                    if(tokens[lineNb][lastword][tokens[lineNb][lastword].size()-1] == '"') {
-                        tokens[lineNb][0] = "db_str";
-                    }
-                    else
-                        Error::error(ERR_STR_INVALID,files[lineNb],lines[lineNb],tokens[lineNb][0]);
+void Assembler::resolveConsts() {
+    unsigned ph = stats.begin("resolveConsts",statCounts());
+    TRACE_SPAN("resolveConsts");
+    // Imported binaries go after the code, in the order they were imported
+    for(unsigned i=0; i<imports.size(); ++i) {
+        int pad = alignLabels ? (totalBytes % 4 != 0 ? 4 - (totalBytes % 4) : 0) : 0;
+        symbols[symbols.find(imports[i].label)].value = totalBytes + pad;
+        totalBytes += imports[i].size;
+    }
+    // Deferred constants, each worked out once, after the ones it names:
+    // depth first from each in turn, on a stack of our own as chains can
+    // be long
+    enum { CONST_NEW, CONST_STACKED, CONST_DONE };
+    deferredOf.assign(symbols.size(),-1);
+    for(unsigned i=0; i<deferred.size(); ++i)
+        deferredOf[deferred[i].sym] = i;
+    deferredState.assign(deferred.size(),CONST_NEW);
+    for(unsigned i=0; i<deferred.size(); ++i) {
+        if(deferredState[i] != CONST_NEW)
+            continue;
+        resolveStack.push_back(i);
+        deferredState[i] = CONST_STACKED;
+        while(!resolveStack.empty()) {
+            unsigned d = resolveStack.back();
+            // Already given 0 as part of a cycle
+            if(deferredState[d] == CONST_DONE) {
+                resolveStack.pop_back();
+                continue;
+            }
+            const DeferredConst& dc = deferred[d];
+            // The first it needs that is not done yet, if any. Those before
+            // it are done by the time d is back on top.
+            int dep = -1;
+            for(u32 j=0; j<dc.nbDeps && dep < 0; ++j) {
+                dep = deferredOf[constDeps[dc.firstDep + j]];
+                if(dep >= 0 && deferredState[dep] == CONST_DONE)
+                    dep = -1;
+            }
+            if(dep >= 0 && deferredState[dep] == CONST_NEW) {
+                resolveStack.push_back(dep);
+                deferredState[dep] = CONST_STACKED;
+                continue;
+            }
+            // Still on the stack: the constants from dep up to d need each
+            // other. Each of them is reported and gets 0.
+            if(dep >= 0) {
+                size_t k = resolveStack.size();
+                while(resolveStack[--k] != (unsigned)dep) {}
+                for(; k<resolveStack.size(); ++k) {
+                    const DeferredConst& c = deferred[resolveStack[k]];
+                    log.error(ERR_CONST_CYCLE,filesImp[c.file],c.line,symbols[c.sym].name);
+                    symbols[c.sym].value = 0;
+                    deferredState[resolveStack[k]] = CONST_DONE;
                 }
-                else
-                    tokens[lineNb][0] = "db_n";
-                break;
-            default:
-                break;
             }
+            else {
+                symbols[dc.sym].value = deferredValue(dc);
+                deferredState[d] = CONST_DONE;
+            }
+            resolveStack.pop_back();
         }
     }
+    stats.end(ph,statCounts());
 }
@@ -10,41 +10,122 @@
 #define _ASSEMBLER_H
 
 #include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <future>
 #include <vector>
 #include <string>
+#include <string_view>
 
 #include "Error.h"
+#include "Arena.h"
 #include "Opcodes.h"
+#include "SymbolTable.h"
+#include "SourceFile.h"
+#include "ThreadPool.h"
+#include "OutputCache.h"
+#include "FileProvider.h"
+#include "RomHeader.h"
+#include "FileWriter.h"
+#include "BuildStats.h"
 
 typedef unsigned char	u8;
 typedef unsigned short	u16;
 typedef unsigned int	u32;
+typedef unsigned long long u64;
 typedef signed char		s8;
 typedef signed short	s16;
 typedef signed int		s32;
 
-typedef std::vector<std::string> line;
-typedef std::vector<line>		 lineList;
-typedef std::pair<int,std::string> lineValPair;
-typedef std::map<std::string,lineValPair> unresMap;
+// importbin FILE OFFSET LENGTH LABEL, checked against the file when read
+struct ImportBin {
+	std::string_view file, label;
+	u32 offset, size;
+	std::string_view data;	// the whole file, mapped or from the provider
+};
+// equ whose value is an expression (see Expression.h), or $-LABEL: the
+// length of the string after LABEL. Worked out once by resolveConsts, when
+// every symbol is defined.
+struct DeferredConst {
+	int sym;		// the constant
+	int ref;		// $-: the label of the string
+	bool length;
+	std::string_view expr;
+	u32 addr;		// value of $
+	u32 firstDep;	// constDeps[firstDep] onwards: the symbols expr names
+	u32 nbDeps;
+	u16 file;
+	u32 line;
+};
 
 const u32 MEM_SIZE = 64*1024;
 
+// Opcode of a statement that could not be decoded (already reported)
+const OPCODE OP_NONE = 0xFF;
+
+// Operand decoded by tokenize: registers, conditions and numbers are
+// final, symbols are looked up and expressions worked out when the
+// statement is written
+struct Operand {
+	u16 value;
+	int sym;		// symbol id, -1 if value is final, or EXPR_OPERAND
+};
+const int EXPR_OPERAND = -2;
+
+// One line of code: tokens[tok] is the mnemonic, followed by its operands,
+// and operands[arg] onwards holds them decoded
+struct Statement {
+	u32 tok;
+	u32 arg;
+	u32 addr;		// position in the output bin
+	u16 size;		// number of tokens, mnemonic included
+	u16 file;		// index in the file table
+	u32 line;
+	OPCODE op;
+};
+
+// Run of statements written to the output by one thread
+struct EmitChunk;
+
 // Assembler class, does the hard work
 class Assembler {
 public:
 	Assembler();
 	~Assembler();
+	// Forget the program and the build options (-o, -a, -z, -r, -m, -v),
+	// to build another one, once the sources being read ahead are done.
+	// Error stream, file provider, threads, caches and statistics (but not
+	// their phases) are kept, and so is the memory taken so far: once it
+	// has built a program as large, an assembler builds the next one
+	// without allocating (outputFile aside).
+	void reset();
 	// Change output name
 	void setOutputFile(const char*);
-	// Build token array
-	void tokenize(const char*);
-	// Compute unresolved consts (eg strlen)
+	// Start reading a source ahead, when using several threads
+	void prefetch(const std::string&);
+	// Build token array; false if a file cannot be read or is included twice
+	bool tokenize(std::string_view);
+	// Give imported binaries their addresses, and constants defined from
+	// other symbols their values, each after the ones it needs
 	void resolveConsts();
-	// Convert mnemonics to internal opcodes
-	void fixOps();
-	// Write buffer to disk
+	// Write the program and its header to the buffer
+	void buildRom();
+	// Build, then write it to disk. Imported binaries go from their files
+	// to the output and are left out of the buffer.
 	void outputFile();
+	// The program built, its header, and its symbols
+	const u8* romData() const { return buffer; }
+	u32 romSize() const { return romBytes; }
+	const ch16_header& romHeader() const { return header; }
+	bool hasHeader() const { return writeHeader; }
+	const SymbolTable& symbolTable() const { return symbols; }
+	// Print errors to a stream instead of stdout (NULL for stdout)
+	void setErrorStream(std::ostream*);
+	// Has any error been reported
+	bool failed() const;
+	// Read files through a provider instead of from disk (NULL for disk)
+	void setFileProvider(FileProvider*);
 	// Command line modifier methods
 	void useVerbose();
 	bool isVerbose();
@@ -52,74 +133,161 @@ public:
 	void useAlign();
 	void putMmap();
     void noHeader();
+	void setJobs(unsigned);
+	// Keep lexed sources in a directory, to skip lexing unchanged ones
+	// Keep the outputs of builds in a directory, to skip repeated ones
+	void useMemo(const char*);
+	// Restore the outputs of an earlier build of the same sources with the
+	// same options, if none of its inputs changed; false if there is none
+	bool restoreOutput(char* const*,int);
+	// Time each phase of the builds (see BuildStats.h); allocs gives the
+	// heap allocations of the process so far, NULL if they are not counted
+	void useStats(unsigned long long (*allocs)() = NULL);
+	const BuildStats& buildStats() const { return stats; }
+	// Value of a number written as in an operand (errors are reported)
+	u16 number(std::string_view s) { return atoi_t(s); }
 	// Debug use
 	void debugOut();
 
 private:
-	// Adapted from prev. ver., useful str->int conversion
-	u16 atoi_t(std::string);
-	// Factored out the initialization of opMap and regMap
-	void initMaps();
-
-	// nop, cls, vblnk, ret, snd0, pushall, popall
-	void op_void(u8*,OPCODE);				
-	// jmp, jmc, jmz, call, spr, snd[1-3], pal
-	void op_imm(u8*,OPCODE,u16);	
-	// jx, cx, snp, sng
-	void op_n_imm(u8*,OPCODE,u8,u16);
-	// bgc
-	void op_n(u8*,OPCODE,u8);				
-	// flip
-	void op_n_n(u8*,OPCODE,u8,u8);
-	// jmp_r, call_r, pal_r, not_r, neg_r
-	void op_r(u8*,OPCODE,u8);
-	// rnd, ldi, ldm, stm, addi, subi, muli, divi, modi, remi, cmpi, andi, tsti, ori, xori, noti, negi
-	void op_r_imm(u8*,OPCODE,u8,u16);
-	// shl_n, shr_n, sar_n
-	void op_r_n(u8*,OPCODE,u8,u8);
-	// drw, jme
-	void op_r_r_imm(u8*,OPCODE,u8,u8,u16);
-	// add_r2, sub_r2, mul_r2, div_r2, mod_r2, rem_r2, and_r2, or_r2, xor_r2, shl_r, shr_r, sar_r, not_r2, neg_r2
-	void op_r_r(u8*,OPCODE,u8,u8);
-	// add_r3, sub_r3, mul_r3, div_r3, mod_r3, rem_r3, cmp, and_r3, tst, or_r3, xor_r3
-	void op_r_r_r(u8*,OPCODE,u8,u8,u8);
+	// Value of a number literal (see Number.h), reporting errors
+	u16 atoi_t(std::string_view);
+	u16 atoi_t(std::string_view,unsigned,ErrorLog&);
+	// Report an error at the statement being processed, or a given one
+	void stmtError(ERROR,std::string_view);
+	void stmtError(unsigned,ERROR,std::string_view,ErrorLog&);
+
+	// tokenize, without the statistics
+	bool tokenizeFile(std::string_view);
+	// Totals the statistics of a phase are worked out from
+	StatCounts statCounts() const;
+
+	// Map or read a file through the provider; false if there is none.
+	// The name must be followed by a '\0'.
+	bool openFile(SourceFile&,std::string_view);
+	// Fill in the data of an importbin, mapping its file unless an earlier
+	// one did; false if it cannot be read
+	bool readImport(ImportBin&);
+	// Add an equ to work out once every symbol is defined
+	void deferConst(std::string_view,std::string_view,bool,int,int);
+	// Value of a deferred constant, once the symbols it needs are known
+	u16 deferredValue(const DeferredConst&);
+	// Value of an expression at address here, once symbols are known,
+	// -32768 to 65535 (0 on error). Errors are reported at a statement,
+	// naming what overflows.
+	int exprValue(std::string_view,u32,unsigned,std::string_view,ErrorLog&);
+	// buildRom, copying the imported binaries to the buffer or not
+	void layoutRom(bool);
+	// Get a mapped and lexed source, waiting for it if it is being read
+	// ahead; NULL if it cannot be opened
+	SourceFile* openSource(std::string_view);
+	// A SourceFile to open, reusing one closed by reset() if there is any;
+	// call with prefetchLock held
+	SourceFile* newSource();
+	// Wait for every source queued by prefetch, and the ones they include
+	void waitPrefetched();
+	// Read ahead the files a lexed source includes
+	void prefetchIncludes(const SourceFile&);
+	// Pick the opcode of a statement and decode its operands
+	void decode(Statement&);
+	// Opcode of a mnemonic, choosing the addressing mode from the operands
+	OPCODE selectOpcode(const std::string_view*,unsigned);
+	// Decode a number operand: a literal, a reference to a symbol, or an
+	// expression
+	Operand numberOperand(std::string_view);
+	// Write a run of statements at their addresses, safe to run concurrently
+	void emit(EmitChunk&);
+	// Value of a decoded number operand of a statement (operand i, for
+	// expressions), once symbols are known
+	u16 operandValue(const Operand&,unsigned,unsigned,ErrorLog&);
+	// Same, and whether it fits a byte (-128 to 255) if it is an expression
+	// or a symbol; literals are checked by decode
+	u16 byteOperand(const Operand&,unsigned,unsigned,ErrorLog&,bool&);
+	// Write an instruction, checking symbol values fit their operand slot
+	void encode(unsigned,u8*,ErrorLog&);
 
 	// Pseudo-instructions
-	void db(u8* bin, std::vector<u8>&);
-	void db(u8* bin, std::string&);
-    void dw(u8* bin, std::vector<u16>&);
+	void db(unsigned,u8*,ErrorLog&);
+	void db(u8*,std::string_view);
+    void dw(unsigned,u8*,ErrorLog&);
+	// Zero fill after size bytes of data if aligning labels
+	void pad(u8*,u32);
 
-    // Output buffer
+    // Errors reported so far
+    ErrorLog log;
+    // Holds the symbol maps and file names, emptied by reset()
+    Arena arena;
+    // Output buffer, and header
     u8* buffer;
+    ch16_header header;
     // Current byte position
     u32 curB;
-	// Parsed source file
-	lineList tokens;
-	// Line numbers
-	std::vector<int> lines;
+    // Size of the program in the header: curB, or 64K with -z
+    u32 romBytes;
+	// Mapped source files, alive as long as the tokens pointing into them;
+	// the first nbSources are in use, the others closed for reuse
+	std::deque<SourceFile> sources;
+	unsigned nbSources;
+	// Sources read ahead by the pool, by file name
+	std::map<std::string,std::shared_future<SourceFile*> > prefetched;
+	std::mutex prefetchLock;					// guards sources and prefetched
+	std::vector<std::shared_future<SourceFile*> > pendingReads;	// used by waitPrefetched
+	ThreadPool* pool;							// NULL when running on one thread
+	FileProvider* files;						// NULL to read from disk
+	OutputCache* memo;							// NULL unless --memo
+	unsigned long long memoKey;					// this build in memo
+	std::vector<BuildInput> memoInputs;			// imported binary ranges read
+	// Parsed source files: all tokens back to back, and the statements
+	// that own them in source order
+	std::vector<std::string_view> tokens;
+	std::vector<Statement> stmts;
+	std::vector<Operand> operands;
+	// Tokens of the line being tokenized. Shared by nested includes, as a
+	// line is done with before the next one is read.
+	line lineToks;
+	// Runs of statements being written, kept to be reused
+	std::vector<std::unique_ptr<EmitChunk> > chunks;
 	// Imported binary files list
-	lineList imports;
-	// Lookup table
-	std::map<std::string,int> stringLines;
-	unresMap unresConsts;
-	std::map<std::string,int> consts;
-	std::vector<std::string> labelNames;
-    std::vector<std::string> constNames;
-	// Opcode map, register map,condition-code map, mnemonic map
-	std::map<std::string,int> opMap, regMap, condMap, mnemMap;
+	std::vector<ImportBin> imports;
+	// Constants waiting for other symbols, in order of definition, and the
+	// symbols each names
+	std::vector<DeferredConst> deferred;
+	std::vector<int> constDeps;
+	// Length of the db string after each label, by symbol id; -1 if none
+	std::vector<int> strLens;
+	// Used by resolveConsts: index in deferred by symbol id (-1 if none),
+	// how far each is, and the ones being worked out
+	std::vector<int> deferredOf;
+	std::vector<u8> deferredState;
+	std::vector<unsigned> resolveStack;
+	// Labels, constants and imported binary labels
+	SymbolTable symbols;
+	int lastLabel;								// id of the latest label, -1 if none
 	// Output filename
 	std::string outputFP;
+	// mmap.txt, formatted here before it is written; kept for the next build
+	std::vector<std::pair<int,std::string_view> > mapLabels;
+	std::string mapText;
+	// What outputFile writes, kept for the next build
+	std::vector<FilePiece> romPieces;
 	// Keep track of progress
-	std::vector<std::string> filesImp, files;	// imported files (avoid cycles), file/line
-	unsigned lineNb;							// line nb in tokens array
+	std::vector<std::string_view> filesImp;		// file table (also avoids cycles)
+	std::vector<const SourceFile*> fileSources;	// contents, same order
+	unsigned lineNb;							// statement being processed
+	int curFile, curLine;						// position being tokenized
 	int curAddress;								// address in output bin
 	int totalBytes;								// size in B of output bin
+	int codeBytes;								// same, without imported binaries
 	// Command line modifiers
 	bool verbose;
 	bool zeroFill;
 	bool alignLabels;
 	bool writeMmap;
     bool writeHeader;
+	unsigned jobs;								// threads writing the output
+	// Per phase statistics, and bytes of sources and binaries read for them
+	BuildStats stats;
+	u64 bytesRead;
     // In-file modifiers
     u16 start;
     double version;
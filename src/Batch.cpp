@@ -0,0 +1,164 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "Batch.h"
+#include "Assembler.h"
+#include "Error.h"
+#include "ThreadPool.h"
+
+typedef std::chrono::steady_clock BatchClock;
+
+bool SharedFiles::read(std::string_view fn, std::string_view& data) {
+    std::lock_guard<std::mutex> l(lock);
+    std::map<std::string,std::unique_ptr<SourceFile>,std::less<> >::iterator it = files.find(fn);
+    if(it == files.end()) {
+        std::string name(fn);
+        std::unique_ptr<SourceFile> file(new SourceFile);
+        if(!file->open(name.c_str()))
+            file.reset();
+        it = files.insert(std::make_pair(name,std::move(file))).first;
+        ++loads;
+    }
+    else
+        ++reuses;
+    if(!it->second)
+        return false;
+    data = std::string_view(it->second->data(),it->second->size());
+    return true;
+}
+
+bool readManifest(const char* fn, std::vector<BatchJob>& jobs, std::ostream& errs) {
+    ErrorLog log(&errs);
+    std::ifstream in(fn);
+    if(!in) {
+        log.error(ERR_IO,fn,0,"batch");
+        return false;
+    }
+    std::string text;
+    for(unsigned nb=1; std::getline(in,text); ++nb) {
+        std::istringstream words(text);
+        std::string w;
+        if(!(words >> w) || w[0] == '#' || w[0] == ';')
+            continue;
+        BatchJob job;
+        job.align = job.zeroFill = job.raw = false;
+        job.line = nb;
+        bool valid = true;
+        do {
+            if(w[0] != '-')
+                job.sources.push_back(w);
+            else if(w == "-o" || w == "-O") {
+                if(!(words >> job.output)) {
+                    log.error(ERR_CMD_NONE,fn,nb,w);
+                    valid = false;
+                }
+            }
+            else if(w == "-a" || w == "-A" || w == "--align")
+                job.align = true;
+            else if(w == "-z" || w == "-Z" || w == "--zero")
+                job.zeroFill = true;
+            else if(w == "-r" || w == "-R" || w == "--raw")
+                job.raw = true;
+            else {
+                log.error(ERR_CMD_UNKNOWN,fn,nb,w);
+                valid = false;
+            }
+        } while(words >> w);
+        // Every job needs its own destination, output.c16 would be shared
+        if(valid && job.output.empty()) {
+            log.error(ERR_CMD_NONE,fn,nb,"-o");
+            valid = false;
+        }
+        if(valid && job.sources.empty()) {
+            log.error(ERR_NO_INPUT,fn,nb,job.output);
+            valid = false;
+        }
+        if(valid)
+            jobs.push_back(job);
+    }
+    return !log.failed();
+}
+
+// What became of a job, kept until every job is done to be printed in order
+struct BatchResult {
+    bool ok;
+    double ms;
+    std::string diag;
+};
+
+static void runJob(const BatchJob& job, Assembler& tc16, SharedFiles& files, BatchResult& res) {
+    BatchClock::time_point t0 = BatchClock::now();
+    std::ostringstream diag;
+    tc16.reset();
+    tc16.setErrorStream(&diag);
+    tc16.setFileProvider(&files);
+    tc16.setOutputFile(job.output.c_str());
+    if(job.align)
+        tc16.useAlign();
+    if(job.zeroFill)
+        tc16.useZeroFill();
+    if(job.raw)
+        tc16.noHeader();
+    bool read = true;
+    for(unsigned i=0; i<job.sources.size() && read; ++i)
+        read = tc16.tokenize(job.sources[i].c_str());
+    if(read) {
+        tc16.resolveConsts();
+        tc16.outputFile();
+    }
+    res.ok = read && !tc16.failed();
+    res.diag = diag.str();
+    res.ms = std::chrono::duration<double,std::milli>(BatchClock::now() - t0).count();
+}
+
+bool runBatch(const std::vector<BatchJob>& jobs, unsigned threads, std::ostream& out) {
+    SharedFiles files;
+    std::vector<BatchResult> results(jobs.size());
+    // An assembler per thread, reset between jobs to reuse its memory
+    std::vector<std::unique_ptr<Assembler> > assemblers(threads);
+    BatchClock::time_point t0 = BatchClock::now();
+    runStealing(threads,(unsigned)jobs.size(),[&](unsigned t, unsigned i) {
+        if(!assemblers[t])
+            assemblers[t].reset(new Assembler);
+        runJob(jobs[i],*assemblers[t],files,results[i]);
+    });
+    double wall = std::chrono::duration<double,std::milli>(BatchClock::now() - t0).count();
+
+    unsigned failed = 0;
+    double busy = 0, slowest = 0;
+    char ms[32];
+    for(size_t i=0; i<jobs.size(); ++i) {
+        const BatchResult& r = results[i];
+        snprintf(ms,sizeof(ms),"%10.3f ms",r.ms);
+        out << (r.ok ? "ok   " : "FAIL ") << ms << "  " << jobs[i].output << "\n";
+        if(!r.ok) {
+            ++failed;
+            // Indented, so that it reads as part of the job above
+            std::istringstream msgs(r.diag);
+            std::string m;
+            while(std::getline(msgs,m))
+                out << "        " << m << "\n";
+        }
+        busy += r.ms;
+        if(r.ms > slowest)
+            slowest = r.ms;
+    }
+    char sum[160];
+    snprintf(sum,sizeof(sum),"\n%u job(s), %u failed, %u thread(s): %.3f ms wall, "
+             "%.3f ms in jobs (%.3f ms average, %.3f ms slowest)\n",
+             (unsigned)jobs.size(),failed,threads,wall,busy,
+             jobs.empty() ? 0.0 : busy / jobs.size(),slowest);
+    out << sum << "Shared files: " << files.filesRead() << " read, "
+        << files.filesReused() << " reused\n";
+    return failed == 0;
+}
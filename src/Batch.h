@@ -0,0 +1,56 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "FileProvider.h"
+#include "SourceFile.h"
+
+// One ROM to build, from a line of a batch manifest
+struct BatchJob {
+	std::vector<std::string> sources;
+	std::string output;
+	bool align, zeroFill, raw;
+	unsigned line;			// in the manifest
+};
+
+// Files read from disk once and then shared by every job of a batch, for
+// includes and binaries used by several ROMs
+class SharedFiles : public FileProvider {
+public:
+	SharedFiles() : loads(0), reuses(0) {}
+	bool read(std::string_view,std::string_view&);
+	unsigned long filesRead() const { return loads; }
+	unsigned long filesReused() const { return reuses; }
+
+private:
+	std::mutex lock;
+	// NULL for files that could not be opened
+	std::map<std::string,std::unique_ptr<SourceFile>,std::less<> > files;
+	std::atomic<unsigned long> loads, reuses;
+};
+
+// Read a manifest: one job per line, written like a tchip16 command line
+//     SOURCE... -o DEST [-a] [-z] [-r]
+// Blank lines and lines starting with # or ; are skipped. Errors are
+// printed to the stream, with their line; false if there were any.
+bool readManifest(const char*,std::vector<BatchJob>&,std::ostream&);
+// Build every job with the given number of threads, print a line per job
+// and a summary to the stream; false if any job failed
+bool runBatch(const std::vector<BatchJob>&,unsigned,std::ostream&);
+
+#endif
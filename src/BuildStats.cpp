@@ -0,0 +1,184 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "BuildStats.h"
+
+long peakRssKb() {
+#ifdef _WIN32
+    return -1;
+#else
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF,&ru) != 0)
+        return -1;
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024;
+#else
+    return ru.ru_maxrss;
+#endif
+#endif
+}
+
+BuildStats::BuildStats() : on(false), allocCount(NULL) {
+}
+
+void BuildStats::enable(unsigned long long (*allocs)()) {
+    on = true;
+    allocCount = allocs;
+    // Room for most builds, so that phases do not count their own entries
+    list.reserve(256);
+    running.reserve(16);
+}
+
+void BuildStats::clear() {
+    list.clear();
+    running.clear();
+}
+
+unsigned BuildStats::begin(const char* name, const StatCounts& now, std::string_view file) {
+    if(!on)
+        return 0;
+    PhaseStats ph = {};
+    ph.name = name;
+    ph.file = file;
+    list.push_back(ph);
+    Running r = {};
+    r.id = list.size() - 1;
+    r.counts = now;
+    running.push_back(r);
+    // Last, so that the bookkeeping above is left out
+    running.back().allocs = allocations();
+    running.back().t = Clock::now();
+    return r.id;
+}
+
+void BuildStats::end(unsigned id, const StatCounts& now) {
+    if(!on)
+        return;
+    Clock::time_point t = Clock::now();
+    unsigned long long allocs = allocations();
+    // Phases not ended (after an error) end with this one
+    while(!running.empty() && running.back().id > id)
+        running.pop_back();
+    if(running.empty() || running.back().id != id)
+        return;
+    Running r = running.back();
+    running.pop_back();
+    double ms = std::chrono::duration<double,std::milli>(t - r.t).count();
+    StatCounts all = { now.bytes - r.counts.bytes, now.statements - r.counts.statements,
+                       now.tokens - r.counts.tokens, now.symbols - r.counts.symbols };
+    PhaseStats& ph = list[id];
+    ph.ms = ms - r.innerMs;
+    ph.counts.bytes = all.bytes - r.inner.bytes;
+    ph.counts.statements = all.statements - r.inner.statements;
+    ph.counts.tokens = all.tokens - r.inner.tokens;
+    ph.counts.symbols = all.symbols - r.inner.symbols;
+    ph.allocs = allocCount ? (long long)(allocs - r.allocs - r.innerAllocs) : -1;
+    ph.peakRssKb = peakRssKb();
+    // The phase it ran in leaves out all of it
+    if(!running.empty()) {
+        Running& outer = running.back();
+        outer.innerMs += ms;
+        outer.inner.bytes += all.bytes;
+        outer.inner.statements += all.statements;
+        outer.inner.tokens += all.tokens;
+        outer.inner.symbols += all.symbols;
+        outer.innerAllocs += allocs - r.allocs;
+    }
+}
+
+static void jsonString(std::ostream& out, std::string_view s) {
+    out << '"';
+    for(size_t i=0; i<s.size(); ++i) {
+        unsigned char c = s[i];
+        if(c == '"' || c == '\\')
+            out << '\\' << c;
+        else if(c < 0x20) {
+            char esc[8];
+            snprintf(esc,sizeof(esc),"\\u%04x",c);
+            out << esc;
+        }
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+static void jsonPhase(std::ostream& out, const PhaseStats& ph) {
+    char num[256];
+    out << "{\"phase\": ";
+    jsonString(out,ph.name);
+    if(!ph.file.empty()) {
+        out << ", \"file\": ";
+        jsonString(out,ph.file);
+    }
+    snprintf(num,sizeof(num),", \"ms\": %.3f, \"bytes\": %llu, \"statements\": %llu, "
+             "\"tokens\": %llu, \"symbols\": %llu",ph.ms,ph.counts.bytes,
+             ph.counts.statements,ph.counts.tokens,ph.counts.symbols);
+    out << num;
+    if(ph.allocs >= 0)
+        out << ", \"allocs\": " << ph.allocs;
+    if(ph.peakRssKb >= 0)
+        out << ", \"peak_rss_kb\": " << ph.peakRssKb;
+    out << "}";
+}
+
+static void textPhase(std::ostream& out, const PhaseStats& ph) {
+    char l[512], allocs[24] = "-", rss[24] = "-";
+    if(ph.allocs >= 0)
+        snprintf(allocs,sizeof(allocs),"%lld",ph.allocs);
+    if(ph.peakRssKb >= 0)
+        snprintf(rss,sizeof(rss),"%.1f MB",ph.peakRssKb/1024.0);
+    std::string_view file = ph.file.empty() ? std::string_view("-") : ph.file;
+    snprintf(l,sizeof(l),"%-13s %-20.*s %10.3f %10llu %8llu %8llu %8llu %9s %9s\n",ph.name,
+             (int)std::min<size_t>(file.size(),200),file.data(),ph.ms,ph.counts.bytes,
+             ph.counts.statements,ph.counts.tokens,ph.counts.symbols,allocs,rss);
+    out << l;
+}
+
+void BuildStats::print(std::ostream& out, bool json) const {
+    PhaseStats total = {};
+    total.name = "total";
+    total.allocs = allocCount ? 0 : -1;
+    total.peakRssKb = -1;
+    for(size_t i=0; i<list.size(); ++i) {
+        const PhaseStats& ph = list[i];
+        total.ms += ph.ms;
+        total.counts.bytes += ph.counts.bytes;
+        total.counts.statements += ph.counts.statements;
+        total.counts.tokens += ph.counts.tokens;
+        total.counts.symbols += ph.counts.symbols;
+        if(ph.allocs >= 0)
+            total.allocs += ph.allocs;
+        total.peakRssKb = std::max(total.peakRssKb,ph.peakRssKb);
+    }
+    if(json) {
+        out << "{\n  \"phases\": [";
+        for(size_t i=0; i<list.size(); ++i) {
+            out << (i ? ",\n    " : "\n    ");
+            jsonPhase(out,list[i]);
+        }
+        out << (list.empty() ? "],\n  \"total\": " : "\n  ],\n  \"total\": ");
+        jsonPhase(out,total);
+        out << "\n}\n";
+        return;
+    }
+    char l[256];
+    snprintf(l,sizeof(l),"%-13s %-20s %10s %10s %8s %8s %8s %9s %9s\n","phase","file","ms","bytes",
+             "stmts","tokens","symbols","allocs","peak RSS");
+    out << l;
+    for(size_t i=0; i<list.size(); ++i)
+        textPhase(out,list[i]);
+    textPhase(out,total);
+}
@@ -0,0 +1,74 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _BUILDSTATS_H
+#define _BUILDSTATS_H
+
+#include <chrono>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// Running totals of an assembler, read when a phase starts and ends
+struct StatCounts {
+	unsigned long long bytes;		// read from sources and imported binaries
+	unsigned long long statements;
+	unsigned long long tokens;
+	unsigned long long symbols;
+};
+
+// What one phase of a build did. A phase run inside another (an included
+// file) is only counted in its own entry.
+struct PhaseStats {
+	const char* name;
+	std::string_view file;			// tokenize only, valid until reset()
+	double ms;
+	StatCounts counts;
+	long long allocs;				// heap allocations, -1 if not counted
+	long peakRssKb;					// peak RSS of the process when it ended, -1 if unknown
+};
+
+// Phases of a build, for --stats. Does nothing until enabled.
+class BuildStats {
+public:
+	BuildStats();
+	// Start collecting; allocs gives the number of heap allocations made so
+	// far by the process (NULL if they are not counted)
+	void enable(unsigned long long (*allocs)());
+	bool enabled() const { return on; }
+	// Forget the phases, keeping their room
+	void clear();
+	// Start a phase, and return the id to end it with
+	unsigned begin(const char* name, const StatCounts& now, std::string_view file = std::string_view());
+	void end(unsigned id, const StatCounts& now);
+	const std::vector<PhaseStats>& phases() const { return list; }
+	// Print every phase and their total, as a table or as JSON
+	void print(std::ostream&, bool json) const;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+	// A phase not ended yet, and what the phases it ran took
+	struct Running {
+		unsigned id;
+		Clock::time_point t;
+		StatCounts counts, inner;
+		unsigned long long allocs, innerAllocs;
+		double innerMs;
+	};
+	unsigned long long allocations() const { return allocCount ? allocCount() : 0; }
+
+	bool on;
+	unsigned long long (*allocCount)();
+	std::vector<PhaseStats> list;
+	std::vector<Running> running;
+};
+
+// Most memory the process has used so far, in KB; -1 if unknown
+long peakRssKb();
+
+#endif
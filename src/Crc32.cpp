@@ -0,0 +1,222 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32_HAVE_CLMUL 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define CRC32_HAVE_ARMV8 1
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "Crc32.h"
+
+// Reflected 0x04c11db7, as used by crc.c
+const uint32_t CRC32_POLY = 0xedb88320;
+
+// slice[0] is the table of crc.c; slice[k] advances a byte through k
+// more zero bytes, so that 8 bytes can be looked up at once
+struct SliceTables {
+    uint32_t slice[8][256];
+
+    constexpr SliceTables() : slice() {
+        for(uint32_t i=0; i<256; ++i) {
+            uint32_t c = i;
+            for(int b=0; b<8; ++b)
+                c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+            slice[0][i] = c;
+        }
+        for(int k=1; k<8; ++k) {
+            for(int i=0; i<256; ++i)
+                slice[k][i] = (slice[k-1][i] >> 8) ^ slice[0][slice[k-1][i] & 0xff];
+        }
+    }
+};
+
+static constexpr SliceTables sliceTables;
+
+static inline uint32_t load32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static crc_t crc32Slice8(crc_t crc, const unsigned char* p, size_t n) {
+    const uint32_t (*t)[256] = sliceTables.slice;
+    uint32_t c = crc;
+    for(; n >= 8; p += 8, n -= 8) {
+        uint32_t lo = c ^ load32(p);
+        uint32_t hi = load32(p + 4);
+        c = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    }
+    for(; n > 0; ++p, --n)
+        c = t[0][(c ^ *p) & 0xff] ^ (c >> 8);
+    return c;
+}
+
+#ifdef CRC32_HAVE_CLMUL
+// Folding with carry-less multiplies, after Intel's "Fast CRC Computation
+// for Generic Polynomials Using PCLMULQDQ Instruction" (2009): four 128-bit
+// lanes are folded 64 bytes at a time, then into one, then reduced to 32
+// bits (Barrett). n must be a multiple of 16, and at least 64.
+__attribute__((target("pclmul,sse4.1")))
+static crc_t crc32ClmulBlocks(crc_t crc, const unsigned char* p, size_t n) {
+    // x^(4*128+32) and x^(4*128-32) mod P, and so on, bit-reflected
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL,0x0154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL,0x01751997d0LL);
+    const __m128i k5k0 = _mm_set_epi64x(0,0x0163cd6124LL);
+    // P(x) and the Barrett constant
+    const __m128i poly = _mm_set_epi64x(0x01f7011641LL,0x01db710641LL);
+    const __m128i mask32 = _mm_setr_epi32(~0,0,~0,0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i*)(p + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i*)(p + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i*)(p + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i*)(p + 0x30));
+    x1 = _mm_xor_si128(x1,_mm_cvtsi32_si128((int)crc));
+    p += 64;
+    n -= 64;
+
+    for(; n >= 64; p += 64, n -= 64) {
+        __m128i x5 = _mm_clmulepi64_si128(x1,k1k2,0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2,k1k2,0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3,k1k2,0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4,k1k2,0x00);
+        x1 = _mm_clmulepi64_si128(x1,k1k2,0x11);
+        x2 = _mm_clmulepi64_si128(x2,k1k2,0x11);
+        x3 = _mm_clmulepi64_si128(x3,k1k2,0x11);
+        x4 = _mm_clmulepi64_si128(x4,k1k2,0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1,x5),_mm_loadu_si128((const __m128i*)(p + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2,x6),_mm_loadu_si128((const __m128i*)(p + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3,x7),_mm_loadu_si128((const __m128i*)(p + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4,x8),_mm_loadu_si128((const __m128i*)(p + 0x30)));
+    }
+
+    // Four lanes into one
+    __m128i x5 = _mm_clmulepi64_si128(x1,k3k4,0x00);
+    x1 = _mm_clmulepi64_si128(x1,k3k4,0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1,x2),x5);
+    x5 = _mm_clmulepi64_si128(x1,k3k4,0x00);
+    x1 = _mm_clmulepi64_si128(x1,k3k4,0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1,x3),x5);
+    x5 = _mm_clmulepi64_si128(x1,k3k4,0x00);
+    x1 = _mm_clmulepi64_si128(x1,k3k4,0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1,x4),x5);
+
+    // Whatever 16 byte blocks are left
+    for(; n >= 16; p += 16, n -= 16) {
+        x5 = _mm_clmulepi64_si128(x1,k3k4,0x00);
+        x1 = _mm_clmulepi64_si128(x1,k3k4,0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1,_mm_loadu_si128((const __m128i*)p)),x5);
+    }
+
+    // 128 bits to 64
+    x2 = _mm_clmulepi64_si128(x1,k3k4,0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1,8),x2);
+    x2 = _mm_srli_si128(x1,4);
+    x1 = _mm_and_si128(x1,mask32);
+    x1 = _mm_clmulepi64_si128(x1,k5k0,0x00);
+    x1 = _mm_xor_si128(x1,x2);
+
+    // Barrett reduction to 32 bits
+    x2 = _mm_and_si128(x1,mask32);
+    x2 = _mm_clmulepi64_si128(x2,poly,0x10);
+    x2 = _mm_and_si128(x2,mask32);
+    x2 = _mm_clmulepi64_si128(x2,poly,0x00);
+    x1 = _mm_xor_si128(x1,x2);
+    return (crc_t)_mm_extract_epi32(x1,1);
+}
+
+static crc_t crc32Clmul(crc_t crc, const unsigned char* p, size_t n) {
+    if(n >= 64) {
+        size_t blocks = n & ~(size_t)15;
+        crc = crc32ClmulBlocks(crc,p,blocks);
+        p += blocks;
+        n -= blocks;
+    }
+    return crc32Slice8(crc,p,n);
+}
+#endif
+
+#ifdef CRC32_HAVE_ARMV8
+// The CRC32 instructions use the same reflected polynomial
+__attribute__((target("+crc")))
+static crc_t crc32Armv8(crc_t crc, const unsigned char* p, size_t n) {
+    uint32_t c = crc;
+    for(; n > 0 && ((uintptr_t)p & 7); ++p, --n)
+        c = __crc32b(c,*p);
+    for(; n >= 8; p += 8, n -= 8)
+        c = __crc32d(c,*(const uint64_t*)p);
+    for(; n > 0; ++p, --n)
+        c = __crc32b(c,*p);
+    return c;
+}
+#endif
+
+bool crc32Supported(CRC32_BACKEND b) {
+    switch(b) {
+    case CRC32_TABLE:
+    case CRC32_SLICE8:
+        return true;
+#ifdef CRC32_HAVE_CLMUL
+    case CRC32_CLMUL:
+        return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+#ifdef CRC32_HAVE_ARMV8
+    case CRC32_ARMV8:
+        return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+    default:
+        return false;
+    }
+}
+
+static CRC32_BACKEND pickBackend() {
+    if(crc32Supported(CRC32_CLMUL))
+        return CRC32_CLMUL;
+    if(crc32Supported(CRC32_ARMV8))
+        return CRC32_ARMV8;
+    return CRC32_SLICE8;
+}
+
+CRC32_BACKEND crc32Best() {
+    static const CRC32_BACKEND best = pickBackend();
+    return best;
+}
+
+const char* crc32Name(CRC32_BACKEND b) {
+    switch(b) {
+    case CRC32_TABLE:	return "table";
+    case CRC32_SLICE8:	return "slice-by-8";
+    case CRC32_CLMUL:	return "pclmul";
+    case CRC32_ARMV8:	return "armv8-crc";
+    default:			return "unknown";
+    }
+}
+
+crc_t crc32UpdateWith(CRC32_BACKEND b, crc_t crc, const unsigned char* p, size_t n) {
+    switch(b) {
+#ifdef CRC32_HAVE_CLMUL
+    case CRC32_CLMUL:	return crc32Clmul(crc,p,n);
+#endif
+#ifdef CRC32_HAVE_ARMV8
+    case CRC32_ARMV8:	return crc32Armv8(crc,p,n);
+#endif
+    case CRC32_SLICE8:	return crc32Slice8(crc,p,n);
+    default:			return crc_update(crc,p,n);
+    }
+}
+
+crc_t crc32Update(crc_t crc, const unsigned char* p, size_t n) {
+    return crc32UpdateWith(crc32Best(),crc,p,n);
+}
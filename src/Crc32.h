@@ -0,0 +1,36 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CRC32_H
+#define _CRC32_H
+
+#include <cstddef>
+
+#include "crc.h"
+
+// Faster ways to compute the CRC of crc.c, giving the same values: start
+// from crc_init(), update, then crc_finalize().
+enum CRC32_BACKEND {
+	CRC32_TABLE,	// crc_update, a byte at a time
+	CRC32_SLICE8,	// 8 bytes at a time, through 8 tables
+	CRC32_CLMUL,	// x86 PCLMULQDQ folding, 64 bytes at a time
+	CRC32_ARMV8		// ARMv8 CRC32 instructions, 8 bytes at a time
+};
+
+// Can this CPU run the backend
+bool crc32Supported(CRC32_BACKEND);
+// Fastest backend this CPU can run, looked up once
+CRC32_BACKEND crc32Best();
+const char* crc32Name(CRC32_BACKEND);
+
+// Update a CRC with a given backend, which must be supported
+crc_t crc32UpdateWith(CRC32_BACKEND,crc_t,const unsigned char*,size_t);
+// Update a CRC with the fastest backend
+crc_t crc32Update(crc_t,const unsigned char*,size_t);
+
+#endif
@@ -0,0 +1,76 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _ENCODER_H
+#define _ENCODER_H
+
+#include "Opcodes.h"
+
+// Operand formats indexed by opcode, built from opcodeFormats at compile
+// time. Opcodes missing from opcodeFormats have valid == false.
+struct OpcodeLayout {
+	bool valid = false;
+	unsigned char nargs = 0;
+	unsigned char args[3] = {};
+};
+
+class FormatTable {
+public:
+	constexpr FormatTable() : layouts() {
+		for(size_t i=0; i<sizeof(opcodeFormats)/sizeof(OpcodeFormat); ++i) {
+			OpcodeLayout& l = layouts[opcodeFormats[i].op];
+			l.valid = true;
+			l.nargs = 0;
+			for(int j=0; j<3; ++j) {
+				l.args[j] = opcodeFormats[i].args[j];
+				if(l.args[j] != ARG_NONE)
+					++l.nargs;
+			}
+		}
+	}
+	constexpr const OpcodeLayout& operator[](OPCODE op) const { return layouts[op]; }
+
+private:
+	OpcodeLayout layouts[256];
+};
+
+inline constexpr FormatTable formatTable;
+
+// Is the operand slot a register (as opposed to a number or condition)
+constexpr bool isRegisterArg(int arg) {
+	return arg == ARG_RX || arg == ARG_RY || arg == ARG_RZ || arg == ARG_SP;
+}
+
+// Largest value an operand slot can hold
+constexpr unsigned argLimit(int arg) {
+	return arg == ARG_HHLL ? 0xFFFF :
+		   (arg == ARG_FLIPH || arg == ARG_FLIPV) ? 1 :
+		   (arg == ARG_RX || arg == ARG_RY || arg == ARG_RZ || arg == ARG_COND) ? 0xF : 0xFF;
+}
+
+// Write a 4-byte instruction from its opcode and already checked operands
+inline void encodeOp(unsigned char* out, OPCODE op, const OpcodeLayout& l, const unsigned short* vals) {
+	out[0] = op;
+	out[1] = 0; out[2] = 0; out[3] = 0;
+	for(int i=0; i<l.nargs; ++i) {
+		unsigned short v = vals[i];
+		switch(l.args[i]) {
+		case ARG_RX: case ARG_COND:	out[1] |= v & 0x0F; break;
+		case ARG_RY:				out[1] |= v << 4; break;
+		case ARG_RZ:				out[2] |= v & 0x0F; break;
+		case ARG_N1:				out[1] = (unsigned char)v; break;
+		case ARG_N2:				out[2] = (unsigned char)v; break;
+		case ARG_HHLL:				out[2] = v & 0xFF; out[3] = v >> 8; break;
+		case ARG_FLIPH:				out[3] |= (v & 1) << 1; break;
+		case ARG_FLIPV:				out[3] |= v & 1; break;
+		default:					break;
+		}
+	}
+}
+
+#endif
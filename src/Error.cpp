@@ -11,90 +11,132 @@
 
 #include "Error.h"
 
-bool Error::output = true;
-
 void Error::error(void)
 {
     std::cout << "error: undefined\n";
-    output = false;
 }
 
 void Error::error(ERROR code) {
     std::cout << "error: ";
-	print(code);
+	print(std::cout,code);
+}
+
+void Error::error(ERROR code, std::string_view fn, int lineNb, std::string_view str) {
+	std::cout << fn << ":" << lineNb << ": "
+		      << "error: " << str << ": ";
+	print(std::cout,code);
+}
+
+ErrorLog::ErrorLog(std::ostream* os) {
+    out = os ? os : &std::cout;
+    errors = 0;
+}
+
+void ErrorLog::setStream(std::ostream* os) {
+    out = os ? os : &std::cout;
+}
+
+void ErrorLog::error(ERROR code) {
+    *out << "error: ";
+    Error::print(*out,code);
+    ++errors;
 }
 
-void Error::error(ERROR code, const std::string& fn, int lineNb, const std::string& str) {
-	std::cout << fn.c_str() << ":" << lineNb << ": "
-		      << "error: " << str.c_str() << ": ";
-	print(code);
+void ErrorLog::error(ERROR code, std::string_view fn, int lineNb, std::string_view str) {
+    *out << fn << ":" << lineNb << ": "
+         << "error: " << str << ": ";
+    Error::print(*out,code);
+    ++errors;
 }
 
-void Error::print(ERROR code) {
+void ErrorLog::append(std::string_view msgs, unsigned n) {
+    *out << msgs;
+    errors += n;
+}
+
+void Error::print(std::ostream& stream, ERROR code) {
 	switch(code) {
 	case ERR_IO:
-		std::cout << "I/O, please check filenames/permissions\n";
+		stream << "I/O, please check filenames/permissions\n";
 		break;
 	case ERR_CMD_NONE:
-		std::cout	<< "expected program argument "
+		stream	<< "expected program argument "
 					<< "(possibly missing dest from [-o dest]?)\n";
 		break;
 	case ERR_NO_INPUT:
-		std::cout	<< "no source file specified "
+		stream	<< "no source file specified "
 					<< "(option --help for help)\n";
 		break;
 	case ERR_CMD_UNKNOWN:
-		std::cout	<< "unknown program argument "
+		stream	<< "unknown program argument "
 					<< "(option --help to see list)\n";
 		break;
 	case ERR_OP_UNKNOWN:
-		std::cout << "unknown opcode encountered\n";
+		stream << "unknown opcode encountered\n";
 		break;
 	case ERR_OP_ARGS:
-		std::cout << "arguments do not match opcode\n";
+		stream << "arguments do not match opcode\n";
 		break;
 	case ERR_NUM_NONE:
-		std::cout << "label/constant does not exist\n";
+		stream << "label/constant does not exist\n";
 		break;
 	case ERR_LABEL_REDEF:
-		std::cout << "label already defined\n";
+		stream << "label already defined\n";
 		break;
 	case ERR_CONST_REDEF:
-		std::cout << "constant already defined\n";
+		stream << "constant already defined\n";
 		break;
 	case ERR_INC_CYCLE:
-		std::cout	<< "import cycle detected "
+		stream	<< "import cycle detected "
 					<< "(file is imported more than once)\n";
 		break;
 	case ERR_INC_NONE:
-		std::cout << "import command missing filename\n";
+		stream << "import command missing filename\n";
 		break;
 	case ERR_TOO_MANY:
-		std::cout	<< "too many arguments "
+		stream	<< "too many arguments "
 					<< "(see spec for instructions)\n"
 					<< "(see readme.txt or run ./tchip16 -h for assembler directives)\n";
 		break;
 	case ERR_NAN:
-		std::cout	<< "not a number "
+		stream	<< "not a number "
 					<< "(possibly undeclared label)\n";
 		break;
 	case ERR_NUM_OVERFLOW:
-		std::cout	<< "number overflow "
+		stream	<< "number overflow "
 					<< "(value is too large for datatype)\n";
 		break;
 	case ERR_STR_INVALID:
-		std::cout	<< "invalid string encountered "
+		stream	<< "invalid string encountered "
 					<< "(maybe missing a '\"')\n";
 		break;
 	case ERR_STR_NOLABEL:
-		std::cout	<< "string has no label, cannot be referenced\n";
+		stream	<< "string has no label, cannot be referenced\n";
+		break;
+	case ERR_ROM_SIZE:
+		stream	<< "program does not fit in 64K of memory\n";
+		break;
+	case ERR_IMPORT_RANGE:
+		stream	<< "offset and length go past the end of the file\n";
+		break;
+	case ERR_CONST_CYCLE:
+		stream	<< "constant depends on itself (through other constants)\n";
+		break;
+	case ERR_EXPR:
+		stream	<< "malformed expression\n";
+		break;
+	case ERR_DIV_ZERO:
+		stream	<< "division by zero in expression\n";
+		break;
+	case ERR_EXPR_LENGTH:
+		stream	<< "$-NAME is a string length, only alone after equ "
+					<< "(write ($)-NAME for the address minus NAME)\n";
 		break;
 	default:
-		std::cout << "unknown error encountered\n";
+		stream << "unknown error encountered\n";
 		break;
 	}
 #ifdef _DEBUG
 	WAIT;
 #endif
-    output = false;
 }
@@ -9,7 +9,8 @@
 #ifndef _ERROR_H
 #define _ERROR_H
 
-#include <string>
+#include <iosfwd>
+#include <string_view>
 
 #define WAIT char c; std::cin.get(&c,1)
 
@@ -17,21 +18,47 @@ enum ERROR {
 	ERR_NONE, ERR_IO, ERR_CMD_NONE, ERR_NO_INPUT, ERR_CMD_UNKNOWN,  
 	ERR_OP_UNKNOWN, ERR_OP_ARGS, ERR_NUM_NONE, ERR_LABEL_REDEF,
 	ERR_CONST_REDEF, ERR_INC_CYCLE, ERR_INC_NONE, ERR_TOO_MANY, 
-	ERR_NAN, ERR_NUM_OVERFLOW, ERR_STR_INVALID, ERR_STR_NOLABEL
+	ERR_NAN, ERR_NUM_OVERFLOW, ERR_STR_INVALID, ERR_STR_NOLABEL, ERR_ROM_SIZE, ERR_IMPORT_RANGE,
+	ERR_CONST_CYCLE, ERR_EXPR, ERR_DIV_ZERO, ERR_EXPR_LENGTH
 };
 
 class Error
 {
 public:
-	static void print(ERROR);
+	static void print(std::ostream&,ERROR);
     
     static void error(void);
 	// only error code
     static void error(ERROR);
 	// error code, filename, line number, object
-    static void error(ERROR,const std::string&,int,const std::string&);
+    static void error(ERROR,std::string_view,int,std::string_view);
+};
+
+// Errors of one assembler, so that several can run at once: they are
+// printed to its own stream, and counted
+class ErrorLog
+{
+public:
+	// NULL prints to stdout
+	explicit ErrorLog(std::ostream* = NULL);
+	void setStream(std::ostream*);
+
+	// only error code
+	void error(ERROR);
+	// error code, filename, line number, object
+	void error(ERROR,std::string_view,int,std::string_view);
+	// Pass on messages logged elsewhere (eg by a worker thread), and the
+	// number of errors they hold
+	void append(std::string_view,unsigned);
+
+	bool failed() const { return errors > 0; }
+	// Start counting again, for a new build
+	void clear() { errors = 0; }
+	unsigned count() const { return errors; }
 
-    static bool output;
+private:
+	std::ostream* out;
+	unsigned errors;
 };
 
 #endif
@@ -0,0 +1,240 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Expression.h"
+
+// Binary operators by precedence, the loosest first
+enum { PREC_OR, PREC_XOR, PREC_AND, PREC_SHIFT, PREC_ADD, PREC_MUL, PREC_TERM };
+
+// Parentheses and unary operators nested deeper are an error, rather than
+// a stack overflow
+const unsigned EXPR_MAX_DEPTH = 256;
+
+static inline bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Characters of names and literals, ie neither operators nor spaces
+static inline bool termChar(char c) {
+    switch(c) {
+    case '+': case '-': case '*': case '/': case '%': case '&': case '|':
+    case '^': case '~': case '<': case '>': case '(': case ')': case '$':
+    case '\'': case ',':
+        return false;
+    default:
+        return !isSpace(c);
+    }
+}
+
+// Recursive descent, one function call per precedence level. Stops at the
+// first error, and when only scanning, calls names without checking values.
+class ExprParser {
+public:
+    ExprParser(std::string_view s, long long h, ExprNames& n, bool eval)
+        : text(s), p(s.data()), end(s.data() + s.size()), here(h), names(n),
+          evaluate(eval), depth(0), status(EXPR_OK), at(s) {}
+
+    EXPR_STATUS parse(long long& value, std::string_view& where) {
+        value = binary(PREC_OR);
+        skipSpace();
+        if(status == EXPR_OK && p != end)
+            fail(EXPR_SYNTAX,text);
+        if(status == EXPR_OK && evaluate && (value < -0x8000 || value > 0xFFFF))
+            fail(EXPR_OVERFLOW,text);
+        where = at;
+        return status;
+    }
+
+private:
+    long long fail(EXPR_STATUS s, std::string_view what) {
+        if(status == EXPR_OK) {
+            status = s;
+            at = what;
+        }
+        return 0;
+    }
+
+    void skipSpace() {
+        while(p < end && isSpace(*p))
+            ++p;
+    }
+
+    // Operator of a precedence level at p, and its length; 0 if none
+    char binaryOp(int prec, unsigned& len) {
+        len = 1;
+        if(p == end)
+            return 0;
+        char c = *p;
+        switch(prec) {
+        case PREC_OR:    return c == '|' ? c : 0;
+        case PREC_XOR:   return c == '^' ? c : 0;
+        case PREC_AND:   return c == '&' ? c : 0;
+        case PREC_SHIFT:
+            len = 2;
+            return (c == '<' || c == '>') && p + 1 < end && p[1] == c ? c : 0;
+        case PREC_ADD:   return c == '+' || c == '-' ? c : 0;
+        case PREC_MUL:   return c == '*' || c == '/' || c == '%' ? c : 0;
+        default:         return 0;
+        }
+    }
+
+    long long binary(int prec) {
+        if(prec == PREC_TERM)
+            return unary();
+        long long v = binary(prec + 1);
+        for(;;) {
+            if(status != EXPR_OK)
+                return 0;
+            skipSpace();
+            unsigned len;
+            char op = binaryOp(prec,len);
+            if(!op)
+                return v;
+            p += len;
+            long long r = binary(prec + 1);
+            if(status != EXPR_OK)
+                return 0;
+            v = apply(op,v,r);
+        }
+    }
+
+    long long apply(char op, long long a, long long b) {
+        if(!evaluate)
+            return 0;
+        long long v = 0;
+        switch(op) {
+        case '|': v = a | b; break;
+        case '^': v = a ^ b; break;
+        case '&': v = a & b; break;
+        case '+': v = a + b; break;
+        case '-': v = a - b; break;
+        case '*': v = a * b; break;
+        case '/':
+        case '%':
+            if(b == 0)
+                return fail(EXPR_DIV_ZERO,text);
+            v = op == '/' ? a / b : a % b;
+            break;
+        case '<':
+            if(b < 0 || b > 31)
+                return fail(EXPR_OVERFLOW,text);
+            v = a * (1LL << b);
+            break;
+        case '>':
+            if(b < 0)
+                return fail(EXPR_OVERFLOW,text);
+            v = b > 62 ? (a < 0 ? -1 : 0) : a >> b;
+            break;
+        }
+        return checked(v);
+    }
+
+    // Values stay within 32 bits, so that products fit in 64
+    long long checked(long long v) {
+        if(v <= -(1LL << 31) || v >= (1LL << 31))
+            return fail(EXPR_OVERFLOW,text);
+        return v;
+    }
+
+    long long unary() {
+        skipSpace();
+        if(p == end)
+            return fail(EXPR_SYNTAX,text);
+        char c = *p;
+        if(c == '-' || c == '+' || c == '~' || c == '(') {
+            if(++depth > EXPR_MAX_DEPTH)
+                return fail(EXPR_SYNTAX,text);
+            ++p;
+            long long v;
+            if(c == '(') {
+                v = binary(PREC_OR);
+                skipSpace();
+                if(p == end || *p != ')')
+                    return fail(EXPR_SYNTAX,text);
+                ++p;
+            }
+            else
+                v = unary();
+            --depth;
+            if(status != EXPR_OK)
+                return 0;
+            return c == '-' ? checked(-v) : c == '~' ? ~v : v;
+        }
+        return term();
+    }
+
+    long long term() {
+        const char* t = p;
+        char c = *p;
+        // $ alone, rather than a hex prefix
+        if(c == '$' && (p + 1 == end || digitValue(p[1]) >= 16)) {
+            ++p;
+            // But not $-NAME, which would read as the string length of equ
+            if(end - p > 1 && p[0] == '-' && termChar(p[1]) && !(p[1] >= '0' && p[1] <= '9') &&
+               p[1] != '#') {
+                const char* n = p + 1;
+                while(n < end && termChar(*n))
+                    ++n;
+                return fail(EXPR_LENGTH,std::string_view(t,n - t));
+            }
+            return here;
+        }
+        if(c == '\'') {
+            long len = p + 1 < end && p[1] == '\\' ? 4 : 3;
+            if(end - p < len)
+                return fail(EXPR_SYNTAX,text);
+            p += len;
+            return number(std::string_view(t,len));
+        }
+        bool literal = (c >= '0' && c <= '9') || c == '$' || c == '#' || c == '%';
+        if(!literal && !termChar(c))
+            return fail(EXPR_SYNTAX,text);
+        ++p;
+        while(p < end && termChar(*p))
+            ++p;
+        std::string_view s(t,p - t);
+        if(literal)
+            return number(s);
+        long long v = 0;
+        if(!names.value(s,v) && evaluate)
+            return fail(EXPR_NAN,s);
+        return v;
+    }
+
+    long long number(std::string_view s) {
+        unsigned short v;
+        switch(parseNumber(s,v)) {
+        case NUM_NAN:       return fail(EXPR_NAN,s);
+        case NUM_OVERFLOW:  return fail(EXPR_OVERFLOW,s);
+        default:            return v;
+        }
+    }
+
+    std::string_view text;
+    const char* p;
+    const char* end;
+    long long here;
+    ExprNames& names;
+    bool evaluate;
+    unsigned depth;
+    EXPR_STATUS status;
+    std::string_view at;
+};
+
+EXPR_STATUS evalExpression(std::string_view text, long long here, ExprNames& names,
+                           long long& value, std::string_view& at) {
+    ExprParser parser(text,here,names,true);
+    return parser.parse(value,at);
+}
+
+bool scanExpression(std::string_view text, ExprNames& names) {
+    ExprParser parser(text,0,names,false);
+    long long value;
+    std::string_view at;
+    return parser.parse(value,at) == EXPR_OK;
+}
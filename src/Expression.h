@@ -0,0 +1,81 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _EXPRESSION_H
+#define _EXPRESSION_H
+
+#include <string_view>
+
+#include "Number.h"
+
+// Constant expressions, as written in operands, equ, db, dw and start:
+//     label+4   SCREEN_W*2+OFFSET   end-start   $+8   ((1 << 4) | 3)
+// Operators, from the tightest: unary - + ~, then * / %, + -, << >>, &, ^
+// and |, as in C. Terms are number literals (see Number.h), names, and $
+// alone, the address of the statement. $-NAME is taken by equ for the
+// length of a string, so it is an error in an expression: ($)-NAME is the
+// address minus NAME. Tokens end at a comma or space, so spaces only go
+// inside parentheses. Worked out on 64 bits; values past 32 bits, and
+// results that do not fit in 16 (-32768 to 65535), overflow.
+
+enum EXPR_STATUS {
+	EXPR_OK,
+	EXPR_SYNTAX,		// malformed
+	EXPR_NAN,			// a term is neither a number nor a known name
+	EXPR_DIV_ZERO,
+	EXPR_OVERFLOW,
+	EXPR_LENGTH			// $-NAME; at is it
+};
+
+// Values of the names in an expression
+class ExprNames {
+public:
+	// Value of a name; false if it has none
+	virtual bool value(std::string_view name, long long& v) = 0;
+protected:
+	~ExprNames() {}
+};
+
+// Work out an expression, here being the value of $. On error, at is the
+// term at fault (EXPR_NAN, EXPR_LENGTH, or a literal that overflows), or
+// the whole text.
+EXPR_STATUS evalExpression(std::string_view text, long long here, ExprNames& names,
+						   long long& value, std::string_view& at);
+// Pass each name of an expression to names, in order, without working it
+// out (to find what it depends on); false if it is malformed
+bool scanExpression(std::string_view text, ExprNames& names);
+
+// Is a token an expression, rather than a lone number literal or name. A
+// name holding '-' (my-label) is one too: callers look the whole token up
+// as a name first.
+constexpr bool isExpression(std::string_view s) {
+	if(s.empty())
+		return false;
+	char first = s[0];
+	if(first == '\'') {
+		unsigned short v = 0;
+		return charLiteral(s,v) != NUM_OK;
+	}
+	if(first == '(' || first == '~' || first == '+' || s == "$")
+		return true;
+	if(first == '-' && s.size() > 1 && !(s[1] >= '0' && s[1] <= '9'))
+		return true;
+	for(size_t i=1; i<s.size(); ++i) {
+		switch(s[i]) {
+		case '+': case '-': case '*': case '/': case '%': case '&': case '|':
+		case '^': case '~': case '<': case '>': case '(': case ')': case '$':
+		case '\'':
+			return true;
+		default:
+			break;
+		}
+	}
+	return false;
+}
+
+#endif
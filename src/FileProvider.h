@@ -0,0 +1,44 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _FILEPROVIDER_H
+#define _FILEPROVIDER_H
+
+#include <map>
+#include <string>
+#include <string_view>
+
+// Where an assembler reads its sources, included files and imported
+// binaries from, when not from disk. read() may be called from several
+// threads at once (-j).
+class FileProvider {
+public:
+	virtual ~FileProvider() {}
+	// Contents of a file, valid as long as the provider; false if there is none
+	virtual bool read(std::string_view,std::string_view&) = 0;
+};
+
+// Files kept in memory, by name
+class MemoryFiles : public FileProvider {
+public:
+	void add(const std::string& name, std::string_view data) {
+		files[name].assign(data.data(),data.size());
+	}
+	bool read(std::string_view name, std::string_view& data) {
+		std::map<std::string,std::string,std::less<> >::const_iterator it = files.find(name);
+		if(it == files.end())
+			return false;
+		data = it->second;
+		return true;
+	}
+
+private:
+	std::map<std::string,std::string,std::less<> > files;
+};
+
+#endif
@@ -0,0 +1,132 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <functional>
+#include <thread>
+
+#ifdef _WIN32
+#include <fstream>
+#include <process.h>
+#include <windows.h>
+#define getpid _getpid
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#include "FileWriter.h"
+
+// Beside the file, so that the rename stays on one file system. Unique to
+// the process and thread, as several builds may write the same file.
+static std::string tempName(const std::string& fn) {
+    char tag[48];
+    snprintf(tag,sizeof(tag),".%d.%zx.tmp",(int)getpid(),
+             std::hash<std::thread::id>()(std::this_thread::get_id()));
+    return fn + tag;
+}
+
+#ifndef _WIN32
+// Below this, writing from memory costs less than opening the file again
+static const size_t COPY_MIN = 4096;
+
+// writev until everything is out, as it may stop short
+static bool writeAll(int fd, struct iovec* iov, int n) {
+    while(n > 0) {
+        ssize_t done = writev(fd,iov,n);
+        if(done < 0)
+            return false;
+        while(n > 0 && (size_t)done >= iov->iov_len) {
+            done -= iov->iov_len;
+            ++iov;
+            --n;
+        }
+        if(n > 0) {
+            iov->iov_base = (char*)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    return true;
+}
+
+// Copy as much of a piece as the kernel will from its file, without it
+// coming through here; returns how much that was
+static size_t copyFromFile(int out, const FilePiece& p) {
+    size_t done = 0;
+#ifdef __linux__
+    int in = open(p.file,O_RDONLY);
+    if(in < 0)
+        return 0;
+    off64_t off = p.offset;
+    while(done < p.size) {
+        ssize_t n = copy_file_range(in,&off,out,NULL,p.size - done,0);
+        // Not supported here, or the file got shorter
+        if(n <= 0)
+            break;
+        done += n;
+    }
+    close(in);
+#endif
+    return done;
+}
+#endif
+
+bool writeFileAtomic(const std::string& fn, const FilePiece* pieces, int n, unsigned long long total) {
+    std::string tmp = tempName(fn);
+    unsigned long long size = 0;
+    for(int i=0; i<n; ++i)
+        size += pieces[i].size;
+#ifndef _WIN32
+    int fd = open(tmp.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0666);
+    if(fd < 0)
+        return false;
+    // Runs of pieces in memory go a writev at a time (well under IOV_MAX)
+    struct iovec iov[16];
+    bool ok = true;
+    for(int i=0; i<n && ok; ) {
+        int k = 0;
+        for(; i<n && k<16; ++i) {
+            const FilePiece& p = pieces[i];
+            size_t done = 0;
+            if(p.file && p.size >= COPY_MIN) {
+                // What came before must be out first
+                ok = writeAll(fd,iov,k);
+                k = 0;
+                done = ok ? copyFromFile(fd,p) : 0;
+            }
+            if(done < p.size) {
+                iov[k].iov_base = (char*)p.data + done;
+                iov[k++].iov_len = p.size - done;
+            }
+        }
+        ok = ok && writeAll(fd,iov,k);
+    }
+    // Unwritten bytes read as zeros
+    if(ok && total > size)
+        ok = ftruncate(fd,total) == 0;
+    ok = (close(fd) == 0) && ok;
+    ok = ok && rename(tmp.c_str(),fn.c_str()) == 0;
+#else
+    std::ofstream out(tmp.c_str(),std::ios::out|std::ios::binary);
+    bool ok = out.is_open();
+    for(int i=0; i<n && ok; ++i)
+        out.write((const char*)pieces[i].data,pieces[i].size);
+    for(; ok && size < total; ++size)
+        out.put(0);
+    out.close();
+    ok = ok && !out.fail();
+    // rename() will not replace a file there
+    ok = ok && MoveFileExA(tmp.c_str(),fn.c_str(),MOVEFILE_REPLACE_EXISTING);
+#endif
+    if(!ok) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
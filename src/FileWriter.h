@@ -0,0 +1,32 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _FILEWRITER_H
+#define _FILEWRITER_H
+
+#include <cstddef>
+#include <string>
+
+// A run of bytes to write. If they are also in a file, at an offset, the
+// system may copy them from there without reading them in.
+struct FilePiece {
+	const void* data;
+	size_t size;
+	const char* file = NULL;
+	unsigned long long offset = 0;
+};
+
+// Write pieces back to back, then zeros up to a total size if it is
+// larger (a sparse extension where the system has them). The file is
+// written aside, pieces in memory a writev at a time and pieces in files
+// with copy_file_range, then renamed into place, so that anyone
+// reading it, a concurrent build included, sees either the old file or
+// the whole new one. false if it could not be written.
+bool writeFileAtomic(const std::string&,const FilePiece*,int,unsigned long long = 0);
+
+#endif
@@ -0,0 +1,47 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <cstddef>
+#include <cstring>
+
+// 64-bit hash of a buffer, 8 bytes at a time (after MurmurHash3's mixing).
+// Only meant to tell file contents apart, not to resist tampering.
+inline unsigned long long hashMix(unsigned long long h, unsigned long long k) {
+	k *= 0x87C37B91114253D5ull;
+	k = (k << 31) | (k >> 33);
+	k *= 0x4CF5AD432745937Full;
+	h ^= k;
+	return ((h << 27) | (h >> 37))*5 + 0x52DCE729;
+}
+
+inline unsigned long long hash64(const void* data, size_t n, unsigned long long seed) {
+	const unsigned char* p = (const unsigned char*)data;
+	unsigned long long h = seed ^ (n * 0x9E3779B97F4A7C15ull);
+	for(; n >= 8; n -= 8, p += 8) {
+		unsigned long long k;
+		memcpy(&k,p,8);
+		h = hashMix(h,k);
+	}
+	if(n > 0) {
+		unsigned long long k = 0;
+		for(size_t i=0; i<n; ++i)
+			k |= (unsigned long long)p[i] << (8*i);
+		h = hashMix(h,k);
+	}
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+#endif
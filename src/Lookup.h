@@ -0,0 +1,115 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LOOKUP_H
+#define _LOOKUP_H
+
+#include <cstddef>
+#include <string_view>
+
+#include "Opcodes.h"
+
+// Case-insensitive name lookups, built by the compiler from the tables in
+// Opcodes.h: nothing is constructed at startup and nothing is allocated.
+
+constexpr char lowerChar(char c) {
+	return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+}
+
+// Compare two names ignoring case
+constexpr bool sameName(std::string_view a, std::string_view b) {
+	if(a.size() != b.size())
+		return false;
+	for(size_t i=0; i<a.size(); ++i) {
+		if(lowerChar(a[i]) != lowerChar(b[i]))
+			return false;
+	}
+	return true;
+}
+
+// FNV-1a over the lowercased name, mixed with a seed
+constexpr unsigned nameHash(std::string_view s, unsigned seed) {
+	unsigned h = 2166136261u ^ seed;
+	for(size_t i=0; i<s.size(); ++i) {
+		h ^= (unsigned char)lowerChar(s[i]);
+		h *= 16777619u;
+	}
+	return h ^ (h >> 15);
+}
+
+// Power of two with at least 4 slots per name, which keeps the seed search short
+constexpr size_t hashSlots(size_t n) {
+	size_t m = 32;
+	while(m < 4*n)
+		m *= 2;
+	return m;
+}
+
+// Collision-free hash of N names: the seed is searched for at compile
+// time, so a lookup is one hash, one slot read and one compare
+template<size_t N>
+class PerfectHash {
+public:
+	static constexpr size_t M = hashSlots(N);
+
+	constexpr PerfectHash(const OpcodeName (&names)[N]) : keys(names), seed(0), slots() {
+		for(seed=0; seed<(1u<<16); ++seed) {
+			if(tryFill())
+				return;
+		}
+	}
+
+	// Index of the name in the table, -1 if it isn't one
+	constexpr int find(std::string_view s) const {
+		int i = slots[nameHash(s,seed) & (M-1)] - 1;
+		return (i >= 0 && sameName(keys[i].name,s)) ? i : -1;
+	}
+	// Value of the name, -1 if it isn't one
+	constexpr int value(std::string_view s) const {
+		int i = find(s);
+		return i >= 0 ? keys[i].value : -1;
+	}
+	constexpr const OpcodeName& operator[](int i) const { return keys[i]; }
+	constexpr bool ok() const { return seed < (1u<<16); }
+
+private:
+	constexpr bool tryFill() {
+		for(size_t i=0; i<M; ++i)
+			slots[i] = 0;
+		for(size_t i=0; i<N; ++i) {
+			size_t h = nameHash(keys[i].name,seed) & (M-1);
+			if(slots[h] != 0)
+				return false;
+			slots[h] = (unsigned char)(i+1);
+		}
+		return true;
+	}
+
+	const OpcodeName* keys;
+	unsigned seed;
+	unsigned char slots[M];		// index+1 of the name, 0 if empty
+};
+
+inline constexpr PerfectHash<sizeof(opcodeNames)/sizeof(OpcodeName)>		opcodeTable(opcodeNames);
+inline constexpr PerfectHash<sizeof(mnemonicNames)/sizeof(OpcodeName)>	mnemonicTable(mnemonicNames);
+inline constexpr PerfectHash<sizeof(registerNames)/sizeof(OpcodeName)>	registerTable(registerNames);
+inline constexpr PerfectHash<sizeof(conditionNames)/sizeof(OpcodeName)>	conditionTable(conditionNames);
+
+static_assert(opcodeTable.ok() && mnemonicTable.ok() && registerTable.ok() &&
+			  conditionTable.ok(), "no perfect hash seed found, grow PerfectHash::M");
+
+// Opcode of an instruction name (eg "add_r3"), -1 if unknown
+inline int findOpcode(std::string_view s) { return opcodeTable.value(s); }
+// chip16_mnemonics value of a multi-mode mnemonic, -1 if unknown
+inline int findMnemonic(std::string_view s) { return mnemonicTable.value(s); }
+// Register number, -1 if not a register
+inline int findRegister(std::string_view s) { return registerTable.value(s); }
+// Branch condition code, -1 if not a condition
+inline int findCondition(std::string_view s) { return conditionTable.value(s); }
+
+#endif
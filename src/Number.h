@@ -0,0 +1,125 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _NUMBER_H
+#define _NUMBER_H
+
+#include <cstddef>
+#include <string_view>
+
+// Number literals, read in one pass over the text without allocating.
+// Notations (case does not matter):
+//     1234, -1234				decimal, -32768 to 65535
+//     0x12ab, $12ab, #12ab		hexadecimal
+//     12abh					hexadecimal, the h after any other notation
+//     0b1010, %1010			binary
+//     'a', '\n'				character: \0 \t \n \r \\ \' are escapes
+
+enum NUMBER_STATUS {
+	NUM_OK,
+	NUM_NAN,			// not a number in any notation
+	NUM_OVERFLOW		// does not fit in 16 bits; value holds the low ones
+};
+
+// Value of a digit in bases up to 16, 16 or more if it is not one
+constexpr unsigned digitValue(char c) {
+	if(c >= '0' && c <= '9')
+		return (unsigned)(c - '0');
+	c |= 0x20;
+	return (c >= 'a' && c <= 'f') ? (unsigned)(c - 'a' + 10) : 16;
+}
+
+constexpr NUMBER_STATUS charLiteral(std::string_view s, unsigned short& value) {
+	if(s.size() == 3 && s[2] == '\'' && s[1] != '\\') {
+		value = (unsigned char)s[1];
+		return NUM_OK;
+	}
+	if(s.size() == 4 && s[1] == '\\' && s[3] == '\'') {
+		switch(s[2]) {
+		case '0':	value = 0; return NUM_OK;
+		case 't':	value = '\t'; return NUM_OK;
+		case 'n':	value = '\n'; return NUM_OK;
+		case 'r':	value = '\r'; return NUM_OK;
+		case '\\':	value = '\\'; return NUM_OK;
+		case '\'':	value = '\''; return NUM_OK;
+		default:	break;
+		}
+	}
+	return NUM_NAN;
+}
+
+// Read a literal. The notation is told from its first and last characters,
+// then every digit is checked and added, and the exact value compared with
+// the 16-bit limit.
+constexpr NUMBER_STATUS parseNumber(std::string_view s, unsigned short& value) {
+	value = 0;
+	size_t n = s.size();
+	if(n == 0)
+		return NUM_NAN;
+	const char* p = s.data();
+	const char* end = p + n;
+	char first = p[0], second = n > 1 ? (char)(p[1] | 0x20) : 0;
+	if(first == '\'')
+		return charLiteral(s,value);
+	unsigned base = 10;
+	bool negative = false;
+	bool prefixed = first == '#' || first == '$' || (first == '0' && second == 'x');
+	if(n > 1 && (end[-1] | 0x20) == 'h' && !prefixed) {
+		base = 16;
+		--end;
+	}
+	else if(first == '#' || first == '$') {
+		base = 16;
+		++p;
+	}
+	else if(first == '0' && second == 'x') {
+		base = 16;
+		p += 2;
+	}
+	else if(first == '%') {
+		base = 2;
+		++p;
+	}
+	else if(first == '0' && second == 'b' && n > 2) {
+		base = 2;
+		p += 2;
+	}
+	else if(first == '-') {
+		negative = true;
+		++p;
+	}
+	if(p == end)
+		return NUM_NAN;
+	// Past the limit, only the low 16 bits are kept, as they are all that
+	// is written if the error is let through
+	unsigned limit = negative ? 0x8000 : 0xFFFF;
+	unsigned v = 0;
+	bool overflow = false;
+	for(; p < end; ++p) {
+		unsigned d = digitValue(*p);
+		if(d >= base)
+			return NUM_NAN;
+		v = v*base + d;
+		if(v > limit) {
+			overflow = true;
+			v &= 0xFFFF;
+		}
+	}
+	value = (unsigned short)(negative ? 0x10000 - v : v);
+	return overflow ? NUM_OVERFLOW : NUM_OK;
+}
+
+// Can a token only be a number, rather than a name
+constexpr bool startsNumber(std::string_view s) {
+	if(s.empty())
+		return false;
+	char c = s[0];
+	return (c >= '0' && c <= '9') || c == '#' || c == '$' || c == '-' || c == '%' || c == '\'';
+}
+
+#endif
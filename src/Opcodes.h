@@ -38,4 +38,114 @@ enum chip16_mnemonics {
     noti,_not,negi,neg,_db
 };
 
+// Operand slots of an instruction, and where they go in its 4 bytes
+// (byte 0 is always the opcode)
+enum chip16_operands {
+	ARG_NONE,
+	ARG_RX,		// register, byte 1 low nibble
+	ARG_RY,		// register, byte 1 high nibble
+	ARG_RZ,		// register, byte 2 low nibble
+	ARG_SP,		// "sp", not encoded
+	ARG_COND,	// branch condition, byte 1 low nibble
+	ARG_N1,		// 8-bit value, byte 1
+	ARG_N2,		// 8-bit value, byte 2
+	ARG_HHLL,	// 16-bit value, bytes 2-3 (little endian)
+	ARG_FLIPH,	// 0 or 1, byte 3 bit 1
+	ARG_FLIPV	// 0 or 1, byte 3 bit 0
+};
+
+struct OpcodeFormat {
+	OPCODE op;
+	unsigned char args[3];
+};
+
+// Operands of every real instruction; the pseudo-opcodes have none
+constexpr OpcodeFormat opcodeFormats[] = {
+	{NOP,{}}, {CLS,{}}, {VBLNK,{}}, {BGC,{ARG_N2}}, {SPR,{ARG_HHLL}},
+	{DRW_I,{ARG_RX,ARG_RY,ARG_HHLL}}, {DRW_R,{ARG_RX,ARG_RY,ARG_RZ}},
+	{RND,{ARG_RX,ARG_HHLL}}, {FLIP,{ARG_FLIPH,ARG_FLIPV}},
+	{SND0,{}}, {SND1,{ARG_HHLL}}, {SND2,{ARG_HHLL}}, {SND3,{ARG_HHLL}},
+	{SNP,{ARG_RX,ARG_HHLL}}, {SNG,{ARG_N1,ARG_HHLL}},
+	{JMP_I,{ARG_HHLL}}, {JMC,{ARG_HHLL}}, {Jx,{ARG_COND,ARG_HHLL}},
+	{JME,{ARG_RX,ARG_RY,ARG_HHLL}}, {CALL_I,{ARG_HHLL}}, {RET,{}},
+	{JMP_R,{ARG_RX}}, {Cx,{ARG_COND,ARG_HHLL}}, {CALL_R,{ARG_RX}},
+	{LDI_R,{ARG_RX,ARG_HHLL}}, {LDI_SP,{ARG_SP,ARG_HHLL}},
+	{LDM_I,{ARG_RX,ARG_HHLL}}, {LDM_R,{ARG_RX,ARG_RY}}, {MOV,{ARG_RX,ARG_RY}},
+	{STM_I,{ARG_RX,ARG_HHLL}}, {STM_R,{ARG_RX,ARG_RY}},
+	{ADDI,{ARG_RX,ARG_HHLL}}, {ADD_R2,{ARG_RX,ARG_RY}}, {ADD_R3,{ARG_RX,ARG_RY,ARG_RZ}},
+	{SUBI,{ARG_RX,ARG_HHLL}}, {SUB_R2,{ARG_RX,ARG_RY}}, {SUB_R3,{ARG_RX,ARG_RY,ARG_RZ}},
+	{CMPI,{ARG_RX,ARG_HHLL}}, {CMP,{ARG_RX,ARG_RY}},
+	{ANDI,{ARG_RX,ARG_HHLL}}, {AND_R2,{ARG_RX,ARG_RY}}, {AND_R3,{ARG_RX,ARG_RY,ARG_RZ}},
+	{TSTI,{ARG_RX,ARG_HHLL}}, {TST,{ARG_RX,ARG_RY}},
+	{ORI,{ARG_RX,ARG_HHLL}}, {OR_R2,{ARG_RX,ARG_RY}}, {OR_R3,{ARG_RX,ARG_RY,ARG_RZ}},
+	{XORI,{ARG_RX,ARG_HHLL}}, {XOR_R2,{ARG_RX,ARG_RY}}, {XOR_R3,{ARG_RX,ARG_RY,ARG_RZ}},
+	{MULI,{ARG_RX,ARG_HHLL}}, {MUL_R2,{ARG_RX,ARG_RY}}, {MUL_R3,{ARG_RX,ARG_RY,ARG_RZ}},
+	{DIVI,{ARG_RX,ARG_HHLL}}, {DIV_R2,{ARG_RX,ARG_RY}}, {DIV_R3,{ARG_RX,ARG_RY,ARG_RZ}},
+	{MODI,{ARG_RX,ARG_HHLL}}, {MOD_R2,{ARG_RX,ARG_RY}}, {MOD_R3,{ARG_RX,ARG_RY,ARG_RZ}},
+	{REMI,{ARG_RX,ARG_HHLL}}, {REM_R2,{ARG_RX,ARG_RY}}, {REM_R3,{ARG_RX,ARG_RY,ARG_RZ}},
+	{SHL_N,{ARG_RX,ARG_N2}}, {SHR_N,{ARG_RX,ARG_N2}}, {SAR_N,{ARG_RX,ARG_N2}},
+	{SHL_R,{ARG_RX,ARG_RY}}, {SHR_R,{ARG_RX,ARG_RY}}, {SAR_R,{ARG_RX,ARG_RY}},
+	{PUSH,{ARG_RX}}, {POP,{ARG_RX}}, {PUSHALL,{}}, {POPALL,{}}, {PUSHF,{}}, {POPF,{}},
+	{PAL_I,{ARG_HHLL}}, {PAL_R,{ARG_RX}},
+	{NOTI,{ARG_RX,ARG_HHLL}}, {NOT_R,{ARG_RX}}, {NOT_R2,{ARG_RX,ARG_RY}},
+	{NEGI,{ARG_RX,ARG_HHLL}}, {NEG_R,{ARG_RX}}, {NEG_R2,{ARG_RX,ARG_RY}}
+};
+
+// Name tables, looked up through the perfect hashes in Lookup.h. inline, so
+// that every file including them shares the arrays those hashes point to
+struct OpcodeName {
+	const char* name;
+	int value;
+};
+
+// Mnemonics with a single addressing mode, and the internal names of each
+// addressing mode of the others (eg "add_r3"). DB and DB_STR are only
+// chosen from db by selectOpcode.
+inline constexpr OpcodeName opcodeNames[] = {
+	{"nop",NOP}, {"cls",CLS}, {"vblnk",VBLNK}, {"bgc",BGC}, {"spr",SPR},
+	{"drw_r",DRW_R}, {"drw_i",DRW_I}, {"rnd",RND}, {"flip",FLIP}, {"snd0",SND0},
+	{"snd1",SND1}, {"snd2",SND2}, {"snd3",SND3}, {"snp",SNP}, {"sng",SNG},
+	{"jmp_i",JMP_I}, {"jmp_r",JMP_R}, {"jmc",JMC}, {"jx",Jx}, {"jme",JME},
+	{"call_i",CALL_I}, {"call_r",CALL_R}, {"cx",Cx}, {"ret",RET}, {"ldi_r",LDI_R},
+	{"ldi_sp",LDI_SP}, {"ldm_i",LDM_I}, {"ldm_r",LDM_R}, {"mov",MOV},
+	{"stm_i",STM_I}, {"stm_r",STM_R}, {"addi",ADDI}, {"add_r2",ADD_R2},
+	{"add_r3",ADD_R3}, {"subi",SUBI}, {"sub_r2",SUB_R2}, {"sub_r3",SUB_R3},
+	{"cmpi",CMPI}, {"cmp",CMP}, {"andi",ANDI}, {"and_r2",AND_R2},
+	{"and_r3",AND_R3}, {"tsti",TSTI}, {"tst",TST}, {"ori",ORI}, {"or_r2",OR_R2},
+	{"or_r3",OR_R3}, {"xori",XORI}, {"xor_r2",XOR_R2}, {"xor_r3",XOR_R3},
+	{"muli",MULI}, {"mul_r2",MUL_R2}, {"mul_r3",MUL_R3}, {"divi",DIVI},
+	{"div_r2",DIV_R2}, {"div_r3",DIV_R3}, {"modi",MODI}, {"mod_r2",MOD_R2},
+	{"mod_r3",MOD_R3}, {"remi",REMI}, {"rem_r2",REM_R2}, {"rem_r3",REM_R3},
+	{"shl_n",SHL_N}, {"sal_n",SHL_N}, {"shr_n",SHR_N}, {"sar_n",SAR_N},
+	{"shl_r",SHL_R}, {"sal_r",SHL_R}, {"shr_r",SHR_R}, {"sar_r",SAR_R},
+	{"push",PUSH}, {"pop",POP}, {"pushall",PUSHALL}, {"popall",POPALL},
+	{"pushf",PUSHF}, {"popf",POPF}, {"pal_i",PAL_I}, {"pal_r",PAL_R},
+	{"noti",NOTI}, {"not_r",NOT_R}, {"not_r2",NOT_R2}, {"negi",NEGI},
+	{"neg_r",NEG_R}, {"neg_r2",NEG_R2}, {"dw",DW},
+	{"start",START}
+};
+
+// Mnemonics that need fixing (multiple addressing modes)
+inline constexpr OpcodeName mnemonicNames[] = {
+	{"drw",drw}, {"jmp",jmp}, {"call",call}, {"ldi",ldi}, {"ldm",ldm}, {"stm",stm},
+	{"add",add}, {"sub",sub}, {"and",_and}, {"or",_or}, {"xor",_xor}, {"mul",mul},
+	{"div",_div}, {"mod",mod}, {"rem",rem}, {"shl",shl}, {"sal",sal}, {"shr",shr},
+	{"sar",sar}, {"pal",pal}, {"not",_not}, {"neg",neg}, {"db",_db}
+};
+
+// Register names
+inline constexpr OpcodeName registerNames[] = {
+	{"r0",0x0}, {"r1",0x1}, {"r2",0x2}, {"r3",0x3}, {"r4",0x4}, {"r5",0x5},
+	{"r6",0x6}, {"r7",0x7}, {"r8",0x8}, {"r9",0x9}, {"ra",0xA}, {"rb",0xB},
+	{"rc",0xC}, {"rd",0xD}, {"re",0xE}, {"rf",0xF}, {"r10",0xA}, {"r11",0xB},
+	{"r12",0xC}, {"r13",0xD}, {"r14",0xE}, {"r15",0xF}
+};
+
+// Condition modes in branching operations
+inline constexpr OpcodeName conditionNames[] = {
+	{"z",0x0}, {"mz",0x0}, {"nz",0x1}, {"n",0x2}, {"nn",0x3}, {"p",0x4}, {"o",0x5},
+	{"no",0x6}, {"a",0x7}, {"ae",0x8}, {"nc",0x8}, {"b",0x9}, {"c",0x9},
+	{"mc",0x9}, {"be",0xA}, {"g",0xB}, {"ge",0xC}, {"l",0xD}, {"le",0xE}
+};
+
 #endif
@@ -0,0 +1,195 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#endif
+
+#include "OutputCache.h"
+#include "SourceFile.h"
+#include "Hash.h"
+#include "FileWriter.h"
+
+static const char* MEMO_MAGIC = "tchip16-memo 1";
+
+// Read a whole file; false if it cannot be
+static bool readFile(const std::string& fn, std::string& data) {
+    std::ifstream in(fn.c_str(),std::ios::in|std::ios::binary);
+    if(!in.is_open())
+        return false;
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    data = ss.str();
+    return true;
+}
+
+static bool writeFile(const std::string& fn, const std::string& data) {
+    FilePiece piece = { data.data(), data.size() };
+    return writeFileAtomic(fn,&piece,1);
+}
+
+static bool copyFile(const std::string& from, const std::string& to) {
+    std::string data;
+    return readFile(from,data) && writeFile(to,data);
+}
+
+// Exclusive lock on a file, held until it goes out of scope, so that builds
+// sharing a directory take turns. Not locked if the file cannot be opened.
+class FileLock {
+public:
+    explicit FileLock(const std::string& fn) {
+#ifdef _WIN32
+        h = CreateFileA(fn.c_str(),GENERIC_READ|GENERIC_WRITE,FILE_SHARE_READ|FILE_SHARE_WRITE,
+                        NULL,OPEN_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+        OVERLAPPED ov = {};
+        if(h != INVALID_HANDLE_VALUE)
+            LockFileEx(h,LOCKFILE_EXCLUSIVE_LOCK,0,1,0,&ov);
+#else
+        fd = open(fn.c_str(),O_RDWR|O_CREAT,0666);
+        if(fd >= 0)
+            while(flock(fd,LOCK_EX) != 0 && errno == EINTR) {}
+#endif
+    }
+    // Closing the file lets go of the lock
+    ~FileLock() {
+#ifdef _WIN32
+        if(h != INVALID_HANDLE_VALUE)
+            CloseHandle(h);
+#else
+        if(fd >= 0)
+            close(fd);
+#endif
+    }
+
+private:
+    FileLock(const FileLock&);
+    FileLock& operator=(const FileLock&);
+#ifdef _WIN32
+    HANDLE h;
+#else
+    int fd;
+#endif
+};
+
+OutputCache::OutputCache(const std::string& d) : dir(d) {
+    nbHits = 0;
+    nbMisses = 0;
+#ifdef _WIN32
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(),0777);
+#endif
+}
+
+std::string OutputCache::path(unsigned long long key, const char* ext) const {
+    char name[32];
+    snprintf(name,sizeof(name),"%016llx.%s",key,ext);
+    return dir + "/" + name;
+}
+
+bool OutputCache::hashRange(BuildInput& in) {
+    FILE* fp = fopen(in.path.c_str(),"rb");
+    if(!fp)
+        return false;
+    std::string data(in.length,'\0');
+    size_t n = 0;
+    if(fseek(fp,in.offset,SEEK_SET) == 0)
+        n = fread(&data[0],1,data.size(),fp);
+    fclose(fp);
+    in.hash = hash64(data.data(),n,in.length);
+    return true;
+}
+
+// Is an input as it was when recorded
+static bool unchanged(const BuildInput& in) {
+    BuildInput now = in;
+    if(in.whole) {
+        SourceFile src;
+        if(!src.open(in.path.c_str()))
+            return false;
+        now.hash = hash64(src.data(),src.size(),0);
+    }
+    else if(!OutputCache::hashRange(now))
+        return false;
+    return now.hash == in.hash;
+}
+
+bool OutputCache::restore(unsigned long long key, const std::string& output, bool mmap) {
+    std::ifstream manifest(path(key,"manifest").c_str());
+    std::string l;
+    bool hit = manifest.is_open() && std::getline(manifest,l) && l == MEMO_MAGIC;
+    while(hit && std::getline(manifest,l)) {
+        // "src HASH PATH" or "bin HASH OFFSET LENGTH PATH"
+        std::istringstream ls(l);
+        std::string kind;
+        BuildInput in;
+        ls >> kind >> std::hex >> in.hash >> std::dec;
+        in.whole = kind == "src";
+        in.offset = 0;
+        in.length = 0;
+        if(!in.whole)
+            ls >> in.offset >> in.length;
+        ls.get();
+        std::getline(ls,in.path);
+        hit = !ls.fail() && (in.whole || kind == "bin") && unchanged(in);
+    }
+    hit = hit && copyFile(path(key,"c16"),output) &&
+          (!mmap || copyFile(path(key,"mmap"),"mmap.txt"));
+    count(hit);
+    return hit;
+}
+
+void OutputCache::save(unsigned long long key, const std::vector<BuildInput>& inputs,
+                       const std::string& output, bool mmap) {
+    // Outputs first: a manifest is only ever found next to them
+    if(!copyFile(output,path(key,"c16")) ||
+       (mmap && !copyFile("mmap.txt",path(key,"mmap"))))
+        return;
+    std::ostringstream manifest;
+    manifest << MEMO_MAGIC << "\n";
+    for(unsigned i=0; i<inputs.size(); ++i) {
+        const BuildInput& in = inputs[i];
+        manifest << (in.whole ? "src " : "bin ") << std::hex << in.hash << std::dec;
+        if(!in.whole)
+            manifest << " " << in.offset << " " << in.length;
+        manifest << " " << in.path << "\n";
+    }
+    writeFile(path(key,"manifest"),manifest.str());
+}
+
+void OutputCache::count(bool hit) {
+    // Running totals, shared by every build using the directory: one at a
+    // time, or builds running together would each miss the other's count
+    FileLock lock(dir + "/stats.lock");
+    std::string fn = dir + "/stats", data;
+    nbHits = 0;
+    nbMisses = 0;
+    if(readFile(fn,data)) {
+        std::istringstream ss(data);
+        std::string name;
+        ss >> name >> nbHits >> name >> nbMisses;
+    }
+    if(hit)
+        ++nbHits;
+    else
+        ++nbMisses;
+    std::ostringstream ss;
+    ss << "hits " << nbHits << "\nmisses " << nbMisses << "\n";
+    writeFile(fn,ss.str());
+}
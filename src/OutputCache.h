@@ -0,0 +1,50 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _OUTPUTCACHE_H
+#define _OUTPUTCACHE_H
+
+#include <string>
+#include <vector>
+
+// A file, or a byte range of one, that a build read
+struct BuildInput {
+	std::string path;
+	bool whole;							// source file, else an importbin range
+	unsigned long long offset, length;
+	unsigned long long hash;
+};
+
+// Output cache (--memo DIR), in the spirit of ccache. A build is keyed
+// on its options and command line sources; the cache keeps a manifest
+// of every input it read with their hashes, and a copy of its outputs.
+// If a later build with the same key finds all those inputs unchanged,
+// the outputs are copied back and nothing is assembled.
+class OutputCache {
+public:
+	explicit OutputCache(const std::string&);
+	// Restore the outputs of a build if none of its inputs changed
+	bool restore(unsigned long long,const std::string&,bool);
+	// Remember the inputs and outputs of a build that succeeded
+	void save(unsigned long long,const std::vector<BuildInput>&,const std::string&,bool);
+	// Hash an importbin range as save() expects it; false if unreadable
+	static bool hashRange(BuildInput&);
+
+	// Totals over every build that used the directory, this one included
+	unsigned long long hits() const { return nbHits; }
+	unsigned long long misses() const { return nbMisses; }
+
+private:
+	std::string path(unsigned long long,const char*) const;
+	void count(bool);
+
+	std::string dir;
+	unsigned long long nbHits, nbMisses;
+};
+
+#endif
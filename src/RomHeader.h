@@ -6,6 +6,9 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifndef _ROMHEADER_H
+#define _ROMHEADER_H
+
 #ifdef C_PLUS_PLUS
 extern "C" {
 #endif
@@ -37,3 +40,5 @@ typedef struct ch16_rom
 #ifdef C_PLUS_PLUS
 }
 #endif
+
+#endif
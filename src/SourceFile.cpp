@@ -0,0 +1,192 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "SourceFile.h"
+
+SourceFile::SourceFile() {
+    base = "";
+    len = 0;
+    pos = 0;
+    mapped = false;
+    borrowed = false;
+}
+
+SourceFile::~SourceFile() {
+    close();
+}
+
+void SourceFile::close() {
+#ifndef _WIN32
+    if(mapped)
+        munmap((void*)base,len);
+    else
+#endif
+    if(len > 0 && !borrowed)
+        delete[] base;
+    base = "";
+    len = 0;
+    pos = 0;
+    mapped = false;
+    borrowed = false;
+    lexed.clear();
+    lineStart.clear();
+}
+
+void SourceFile::assign(std::string_view data) {
+    base = data.data();
+    len = data.size();
+    pos = 0;
+    borrowed = true;
+}
+
+bool SourceFile::open(const char* fn) {
+#ifndef _WIN32
+    int fd = ::open(fn,O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd,&st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+    // Empty files cannot be mapped, but have nothing to read anyway
+    if(st.st_size > 0) {
+        void* p = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+        if(p == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+        base = (const char*)p;
+        len = st.st_size;
+        mapped = true;
+        madvise(p,len,MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+    return true;
+#else
+    FILE* fp = fopen(fn,"rb");
+    if(!fp)
+        return false;
+    fseek(fp,0,SEEK_END);
+    long sz = ftell(fp);
+    fseek(fp,0,SEEK_SET);
+    if(sz > 0) {
+        char* buf = new char[sz];
+        len = fread(buf,1,sz,fp);
+        base = buf;
+    }
+    fclose(fp);
+    return true;
+#endif
+}
+
+static inline bool isDelim(char c) {
+    return c == ' ' || c == '\t' || c == ',' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// End of the character literal at p, like ' ' or '\'', which may hold a
+// delimiter; p + 1 if there is none
+static inline const char* skipChar(const char* p, const char* eol) {
+    if(eol - p >= 3 && p[1] != '\\' && p[2] == '\'')
+        return p + 3;
+    if(eol - p >= 4 && p[1] == '\\' && p[3] == '\'')
+        return p + 4;
+    return p + 1;
+}
+
+bool SourceFile::nextLine(line& toks) {
+    toks.clear();
+    return splitLine(toks);
+}
+
+bool SourceFile::splitLine(line& toks) {
+    if(pos >= len)
+        return false;
+    const char* p = base + pos;
+    const char* end = base + len;
+    const char* eol = p;
+    while(eol < end && *eol != '\n')
+        ++eol;
+    pos = (eol - base) + 1;
+
+    while(p < eol) {
+        while(p < eol && isDelim(*p))
+            ++p;
+        if(p == eol || *p == ';')
+            break;
+        const char* t = p;
+        if(*p == '"') {
+            // A string runs up to the last quote on the line,
+            // keeping its commas and whitespace
+            const char* q = eol - 1;
+            while(q > p && *q != '"')
+                --q;
+            if(q > p) {
+                toks.push_back(std::string_view(t,q - t + 1));
+                p = q + 1;
+                continue;
+            }
+        }
+        for(;;) {
+            while(p < eol && !isDelim(*p) && *p != '(' && *p != '\'')
+                ++p;
+            if(p == eol || isDelim(*p))
+                break;
+            if(*p == '\'') {
+                p = skipChar(p,eol);
+                continue;
+            }
+            // Commas and whitespace inside parentheses belong to the token,
+            // for expressions like (SCREEN_W / 2)
+            int depth = 0;
+            while(p < eol && *p != ';') {
+                if(*p == '\'') {
+                    p = skipChar(p,eol);
+                    continue;
+                }
+                if(*p == '(')
+                    ++depth;
+                else if(*p == ')' && --depth == 0)
+                    break;
+                ++p;
+            }
+            if(p == eol || *p == ';')
+                break;
+            ++p;
+        }
+        toks.push_back(std::string_view(t,p - t));
+    }
+    return true;
+}
+
+void SourceFile::lex() {
+    lexed.clear();
+    lineStart.clear();
+    pos = 0;
+    // Straight into lexed, which keeps its size from one file to the next
+    for(;;) {
+        unsigned first = lexed.size();
+        if(!splitLine(lexed))
+            break;
+        lineStart.push_back(first);
+    }
+    lineStart.push_back(lexed.size());
+}
+
+void SourceFile::getLine(unsigned i, line& toks) const {
+    toks.assign(lexed.begin()+lineStart[i],lexed.begin()+lineStart[i+1]);
+}
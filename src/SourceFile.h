@@ -0,0 +1,61 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SOURCEFILE_H
+#define _SOURCEFILE_H
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+typedef std::vector<std::string_view> line;
+
+// A source file mapped into memory, read one line of tokens at a time.
+// Tokens point straight into the mapping, so the SourceFile must outlive
+// every token taken from it.
+// lex() splits the whole file at once instead, which lets it be done
+// ahead of time on another thread; lines are then read with getLine().
+class SourceFile {
+public:
+	SourceFile();
+	~SourceFile();
+	// Map the file; false if it cannot be opened
+	bool open(const char*);
+	// Read from memory owned by someone else instead
+	void assign(std::string_view);
+	// Unmap the file, keeping the room taken by its tokens to be reused
+	// by the next file opened
+	void close();
+	// Split the next line into tokens; false at end of file
+	bool nextLine(line&);
+	// Split every line into tokens
+	void lex();
+	unsigned lineCount() const { return lineStart.empty() ? 0 : (unsigned)lineStart.size() - 1; }
+	// Tokens of a line of a lexed file, 0 being the first line
+	void getLine(unsigned,line&) const;
+
+	const char* data() const { return base; }
+	size_t size() const { return len; }
+
+private:
+	SourceFile(const SourceFile&);
+	SourceFile& operator=(const SourceFile&);
+	// Add the tokens of the next line to the list; false at end of file
+	bool splitLine(line&);
+
+	const char* base;
+	size_t len;
+	size_t pos;			// start of the next line
+	bool mapped;		// false if base was read into the heap instead
+	bool borrowed;		// base belongs to someone else
+	// Filled in by lex: all tokens, and where each line starts among them
+	std::vector<std::string_view> lexed;
+	std::vector<unsigned> lineStart;
+};
+
+#endif
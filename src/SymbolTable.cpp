@@ -0,0 +1,62 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SymbolTable.h"
+
+SymbolTable::SymbolTable(Arena& arena)
+    : ids(0,IdMap::hasher(),IdMap::key_equal(),IdMap::allocator_type(&arena)) {
+}
+
+int SymbolTable::intern(std::string_view name) {
+    IdMap::iterator it = ids.find(name);
+    if(it != ids.end())
+        return it->second;
+    int id = (int)syms.size();
+    Symbol s;
+    s.name = name;
+    s.kind = SYM_NONE;
+    s.value = 0;
+    s.file = -1;
+    s.line = 0;
+    syms.push_back(s);
+    ids[name] = id;
+    return id;
+}
+
+int SymbolTable::find(std::string_view name) const {
+    IdMap::const_iterator it = ids.find(name);
+    return it != ids.end() ? it->second : -1;
+}
+
+const Symbol* SymbolTable::lookup(std::string_view name) const {
+    int id = find(name);
+    if(id < 0 || syms[id].kind == SYM_NONE)
+        return NULL;
+    return &syms[id];
+}
+
+bool SymbolTable::define(int id, SYMBOL_KIND kind, int value, int file, int line) {
+    if(syms[id].kind != SYM_NONE)
+        return false;
+    syms[id].kind = kind;
+    syms[id].value = value;
+    syms[id].file = file;
+    syms[id].line = line;
+    return true;
+}
+
+bool SymbolTable::isLabel(int id) const {
+    return syms[id].kind == SYM_LABEL || syms[id].kind == SYM_IMPORT;
+}
+
+void SymbolTable::clear() {
+    syms.clear();
+    // The buckets are in the arena too: start again from an empty map,
+    // which holds none
+    IdMap(0,ids.hash_function(),ids.key_eq(),ids.get_allocator()).swap(ids);
+}
@@ -0,0 +1,60 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SYMBOLTABLE_H
+#define _SYMBOLTABLE_H
+
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+#include "Arena.h"
+
+enum SYMBOL_KIND {
+	SYM_NONE, SYM_LABEL, SYM_CONST, SYM_IMPORT
+};
+
+struct Symbol {
+	std::string_view name;	// points into the defining source
+	SYMBOL_KIND kind;	// SYM_NONE while only referenced
+	int value;
+	int file;			// index of the defining file, -1 if undefined
+	int line;
+};
+
+// Interned labels/constants: each name is hashed once and then
+// referred to by its index in the table. The name index lives in an arena.
+class SymbolTable {
+public:
+	explicit SymbolTable(Arena&);
+	// Get the id of a name, adding an undefined entry if it is new
+	int intern(std::string_view);
+	// Get the id of a name, or -1 if it was never seen
+	int find(std::string_view) const;
+	// Get the symbol behind a name if it has been defined, else NULL
+	const Symbol* lookup(std::string_view) const;
+	// Give an interned symbol its definition; false if already defined
+	bool define(int,SYMBOL_KIND,int,int,int);
+	// Is the symbol defined as a label (or imported binary label)
+	bool isLabel(int) const;
+
+	Symbol& operator[](int id) { return syms[id]; }
+	const Symbol& operator[](int id) const { return syms[id]; }
+	int size() const { return (int)syms.size(); }
+	// Forget every symbol, keeping the capacity; call before resetting the arena
+	void clear();
+
+private:
+	typedef std::unordered_map<std::string_view,int,std::hash<std::string_view>,
+		std::equal_to<std::string_view>,ArenaAllocator<std::pair<const std::string_view,int> > > IdMap;
+
+	std::vector<Symbol> syms;
+	IdMap ids;
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <memory>
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned n) {
+    stopping = false;
+    for(unsigned i=0; i<n; ++i)
+        workers.push_back(std::thread(&ThreadPool::run,this));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> l(lock);
+        stopping = true;
+    }
+    ready.notify_all();
+    for(unsigned i=0; i<workers.size(); ++i)
+        workers[i].join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> l(lock);
+        tasks.push_back(task);
+    }
+    ready.notify_one();
+}
+
+void ThreadPool::run() {
+    for(;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> l(lock);
+            while(!stopping && tasks.empty())
+                ready.wait(l);
+            if(tasks.empty())
+                return;
+            task = tasks.front();
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+// Indices still to run on one thread: the owner takes from the front,
+// thieves from the back
+struct StealQueue {
+    std::mutex lock;
+    std::deque<unsigned> items;
+};
+
+static bool takeFront(StealQueue& q, unsigned& i) {
+    std::lock_guard<std::mutex> l(q.lock);
+    if(q.items.empty())
+        return false;
+    i = q.items.front();
+    q.items.pop_front();
+    return true;
+}
+
+static bool takeBack(StealQueue& q, unsigned& i) {
+    std::lock_guard<std::mutex> l(q.lock);
+    if(q.items.empty())
+        return false;
+    i = q.items.back();
+    q.items.pop_back();
+    return true;
+}
+
+static void steal(std::vector<std::unique_ptr<StealQueue> >& queues, unsigned self,
+           const std::function<void(unsigned,unsigned)>& task) {
+    unsigned n = (unsigned)queues.size();
+    for(;;) {
+        unsigned i;
+        if(takeFront(*queues[self],i)) {
+            task(self,i);
+            continue;
+        }
+        // Nothing left here, look at the others in turn. No task adds
+        // new indices, so once every queue is empty we are done.
+        bool found = false;
+        for(unsigned k=1; k<n && !found; ++k)
+            found = takeBack(*queues[(self+k) % n],i);
+        if(!found)
+            return;
+        task(self,i);
+    }
+}
+
+void runStealing(unsigned threads, unsigned count, const std::function<void(unsigned,unsigned)>& task) {
+    if(threads < 1)
+        threads = 1;
+    if(threads > count)
+        threads = count > 0 ? count : 1;
+    std::vector<std::unique_ptr<StealQueue> > queues;
+    for(unsigned t=0; t<threads; ++t)
+        queues.push_back(std::unique_ptr<StealQueue>(new StealQueue));
+    // Neighbouring indices stay on the same thread to begin with
+    for(unsigned i=0; i<count; ++i)
+        queues[(unsigned)((unsigned long long)i * threads / count)]->items.push_back(i);
+
+    std::vector<std::thread> helpers;
+    for(unsigned t=1; t<threads; ++t)
+        helpers.push_back(std::thread(steal,std::ref(queues),t,std::cref(task)));
+    steal(queues,0,task);
+    for(unsigned t=0; t<helpers.size(); ++t)
+        helpers[t].join();
+}
@@ -0,0 +1,47 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Fixed set of worker threads running queued tasks in order.
+// Tasks must not wait on each other.
+class ThreadPool {
+public:
+	explicit ThreadPool(unsigned);
+	// Runs whatever is still queued, then joins the workers
+	~ThreadPool();
+	void submit(std::function<void()>);
+	unsigned size() const { return (unsigned)workers.size(); }
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+	void run();
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()> > tasks;
+	std::mutex lock;
+	std::condition_variable ready;
+	bool stopping;
+};
+
+// Run task(t,0) .. task(t,count-1) on a number of threads, t being the
+// thread (0 to threads-1), then return. Each thread starts with its own
+// share of the indices and, once done with them, steals the last ones
+// left to another thread, so uneven tasks do not leave threads idle.
+void runStealing(unsigned,unsigned,const std::function<void(unsigned,unsigned)>&);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Trace.h"
+
+#ifdef TCHIP16_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include "FileWriter.h"
+
+// A span once it has ended
+struct TraceEvent {
+    const char* name;
+    std::string file;
+    double start, dur;			// microseconds since traceStart()
+    unsigned tid;
+    const char* keys[4];
+    long long values[4];
+    int nbArgs;
+};
+
+static std::atomic<bool> tracing(false);
+static std::chrono::steady_clock::time_point origin;
+static std::mutex eventsLock;
+static std::vector<TraceEvent> events;
+static std::atomic<unsigned> nbThreads(0);
+
+static thread_local TraceSpan* innermost = NULL;
+static thread_local unsigned threadId = nbThreads++;
+
+static double now() {
+    return std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void traceStart() {
+    // The thread starting is thread 0
+    (void)threadId;
+    origin = std::chrono::steady_clock::now();
+    tracing = true;
+}
+
+TraceSpan::TraceSpan(const char* n, std::string_view f)
+    : name(n), start(0), nbArgs(0), outer(NULL), on(tracing) {
+    if(!on)
+        return;
+    file = f;
+    (void)threadId;
+    outer = innermost;
+    innermost = this;
+    start = now();
+}
+
+TraceSpan::~TraceSpan() {
+    if(!on)
+        return;
+    TraceEvent e;
+    e.dur = now() - start;
+    e.start = start;
+    e.name = name;
+    e.file.swap(file);
+    e.tid = threadId;
+    e.nbArgs = nbArgs;
+    for(int i=0; i<nbArgs; ++i) {
+        e.keys[i] = keys[i];
+        e.values[i] = values[i];
+    }
+    innermost = outer;
+    std::lock_guard<std::mutex> lock(eventsLock);
+    events.push_back(std::move(e));
+}
+
+TraceSpan* TraceSpan::current() {
+    return innermost;
+}
+
+void TraceSpan::arg(const char* key, long long value) {
+    if(nbArgs < MAX_ARGS) {
+        keys[nbArgs] = key;
+        values[nbArgs++] = value;
+    }
+}
+
+static void jsonString(std::string& out, std::string_view s) {
+    out += '"';
+    for(size_t i=0; i<s.size(); ++i) {
+        unsigned char c = s[i];
+        if(c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if(c < 0x20) {
+            char esc[8];
+            snprintf(esc,sizeof(esc),"\\u%04x",c);
+            out += esc;
+        }
+        else
+            out += c;
+    }
+    out += '"';
+}
+
+bool traceWrite(const std::string& fn) {
+    std::string json = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    std::lock_guard<std::mutex> lock(eventsLock);
+    char num[128];
+    for(unsigned t=0; t<nbThreads; ++t) {
+        snprintf(num,sizeof(num),"{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                 "\"args\": {\"name\": \"%s %u\"}}",t,t ? "thread" : "main",t);
+        json += t ? ",\n" : "";
+        json += num;
+    }
+    for(size_t i=0; i<events.size(); ++i) {
+        const TraceEvent& e = events[i];
+        json += nbThreads || i ? ",\n{\"name\": " : "{\"name\": ";
+        jsonString(json,e.name);
+        snprintf(num,sizeof(num),", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f",
+                 e.tid,e.start,e.dur);
+        json += num;
+        if(!e.file.empty() || e.nbArgs > 0) {
+            json += ", \"args\": {";
+            if(!e.file.empty()) {
+                json += "\"file\": ";
+                jsonString(json,e.file);
+            }
+            for(int a=0; a<e.nbArgs; ++a) {
+                if(a > 0 || !e.file.empty())
+                    json += ", ";
+                jsonString(json,e.keys[a]);
+                snprintf(num,sizeof(num),": %lld",e.values[a]);
+                json += num;
+            }
+            json += "}";
+        }
+        json += "}";
+    }
+    json += "\n]}\n";
+    FilePiece all = { json.data(), json.size() };
+    return writeFileAtomic(fn,&all,1);
+}
+
+#endif
@@ -0,0 +1,70 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+// Timeline of a run in the trace event format of chrome://tracing and
+// Perfetto: a span for each file tokenized or lexed, importbin read, run
+// of statements written and output file. Only built with TCHIP16_TRACE
+// (make TRACE=1); otherwise the macros below are empty.
+//
+//     TRACE_SPAN(name)				span until the end of the scope
+//     TRACE_SPAN_FILE(name,file)	the same, with the file as argument
+//     TRACE_ARG(key,value)			integer argument of the innermost span
+//									of this thread
+
+#ifdef TCHIP16_TRACE
+
+#include <string>
+#include <string_view>
+
+class TraceSpan {
+public:
+	TraceSpan(const char* name, std::string_view file = std::string_view());
+	~TraceSpan();
+	// Innermost span of the calling thread, NULL if none
+	static TraceSpan* current();
+	void arg(const char* key, long long value);
+
+private:
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+	static const int MAX_ARGS = 4;
+	const char* name;
+	std::string file;
+	double start;
+	const char* keys[MAX_ARGS];
+	long long values[MAX_ARGS];
+	int nbArgs;
+	TraceSpan* outer;
+	bool on;
+};
+
+// Start recording spans; they are not before
+void traceStart();
+// Write the spans recorded so far as JSON; false if the file cannot be
+bool traceWrite(const std::string&);
+
+#define TRACE_CAT2(a,b) a##b
+#define TRACE_CAT(a,b) TRACE_CAT2(a,b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CAT(traceSpan,__LINE__)(name)
+#define TRACE_SPAN_FILE(name,file) TraceSpan TRACE_CAT(traceSpan,__LINE__)(name,file)
+#define TRACE_ARG(key,value) \
+	do { if(TraceSpan* s_ = TraceSpan::current()) s_->arg(key,(long long)(value)); } while(0)
+
+#else
+
+#define TRACE_SPAN(name) do {} while(0)
+#define TRACE_SPAN_FILE(name,file) do {} while(0)
+#define TRACE_ARG(key,value) do {} while(0)
+
+#endif
+
+#endif
@@ -0,0 +1,142 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <map>
+
+#include "Verify.h"
+#include "SourceFile.h"
+#include "ThreadPool.h"
+#include "RomHeader.h"
+#include "Crc32.h"
+
+const unsigned ROM_MAGIC_NUMBER = 0x36314843;	// "CH16"
+
+static const char* const statusNames[] = {
+    "ok", "unreadable", "short", "magic", "truncated", "trailing", "crc"
+};
+
+struct RomCheck {
+    ROM_STATUS status;
+    unsigned char specVer;
+    unsigned romSize;		// from the header
+    unsigned long long fileSize;
+    unsigned crcHeader, crcData;
+};
+
+static unsigned readLE(const unsigned char* p, int n) {
+    unsigned v = 0;
+    for(int i=n-1; i>=0; --i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static void checkRom(const std::string& fn, RomCheck& r) {
+    r.status = ROM_OK;
+    r.specVer = 0;
+    r.romSize = 0;
+    r.fileSize = 0;
+    r.crcHeader = r.crcData = 0;
+    SourceFile rom;
+    if(!rom.open(fn.c_str())) {
+        r.status = ROM_UNREADABLE;
+        return;
+    }
+    const unsigned char* p = (const unsigned char*)rom.data();
+    r.fileSize = rom.size();
+    if(rom.size() < CH16_HEADER_SIZE) {
+        r.status = ROM_SHORT;
+        return;
+    }
+    // Field by field: the header is packed and little endian
+    unsigned magic = readLE(p,4);
+    r.specVer = p[5];
+    r.romSize = readLE(p + 6,4);
+    r.crcHeader = readLE(p + 12,4);
+    if(magic != ROM_MAGIC_NUMBER) {
+        r.status = ROM_MAGIC;
+        return;
+    }
+    unsigned long long data = rom.size() - CH16_HEADER_SIZE;
+    if(data < r.romSize) {
+        r.status = ROM_TRUNCATED;
+        return;
+    }
+    if(data > r.romSize) {
+        r.status = ROM_TRAILING;
+        return;
+    }
+    r.crcData = crc_finalize(crc32Update(crc_init(),p + CH16_HEADER_SIZE,r.romSize));
+    if(r.crcData != r.crcHeader)
+        r.status = ROM_CRC;
+}
+
+static void jsonString(std::ostream& out, const std::string& s) {
+    out << '"';
+    for(size_t i=0; i<s.size(); ++i) {
+        unsigned char c = s[i];
+        if(c == '"' || c == '\\')
+            out << '\\' << c;
+        else if(c < 0x20) {
+            char esc[8];
+            snprintf(esc,sizeof(esc),"\\u%04x",c);
+            out << esc;
+        }
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+bool verifyRoms(const std::vector<std::string>& roms, unsigned threads, std::ostream& out) {
+    std::vector<RomCheck> checks(roms.size());
+    runStealing(threads,(unsigned)roms.size(),[&](unsigned, unsigned i) {
+        checkRom(roms[i],checks[i]);
+    });
+
+    unsigned counts[ROM_CRC+1] = {};
+    std::map<unsigned,unsigned> versions;
+    for(size_t i=0; i<checks.size(); ++i) {
+        ++counts[checks[i].status];
+        if(checks[i].status >= ROM_TRUNCATED || checks[i].status == ROM_OK)
+            ++versions[checks[i].specVer];
+    }
+
+    char num[64];
+    out << "{\n  \"files\": " << roms.size() << ",\n";
+    for(int s=ROM_OK; s<=ROM_CRC; ++s)
+        out << "  \"" << statusNames[s] << "\": " << counts[s] << ",\n";
+    // Versions of every ROM with a valid header, as "major.minor"
+    out << "  \"spec_versions\": {";
+    for(std::map<unsigned,unsigned>::const_iterator it=versions.begin(); it!=versions.end(); ++it) {
+        snprintf(num,sizeof(num),"\"%u.%u\": %u",it->first >> 4,it->first & 0xF,it->second);
+        out << (it == versions.begin() ? "" : ", ") << num;
+    }
+    out << "},\n  \"problems\": [";
+    bool first = true;
+    for(size_t i=0; i<checks.size(); ++i) {
+        const RomCheck& r = checks[i];
+        if(r.status == ROM_OK)
+            continue;
+        out << (first ? "\n" : ",\n") << "    {\"file\": ";
+        jsonString(out,roms[i]);
+        out << ", \"status\": \"" << statusNames[r.status] << "\"";
+        if(r.status >= ROM_TRUNCATED) {
+            snprintf(num,sizeof(num),", \"rom_size\": %u, \"file_size\": %llu",r.romSize,r.fileSize);
+            out << num;
+        }
+        if(r.status == ROM_CRC) {
+            snprintf(num,sizeof(num),", \"crc\": \"0x%08x\", \"expected\": \"0x%08x\"",r.crcData,r.crcHeader);
+            out << num;
+        }
+        out << "}";
+        first = false;
+    }
+    out << (first ? "]\n}\n" : "\n  ]\n}\n");
+    return counts[ROM_OK] == roms.size();
+}
@@ -0,0 +1,32 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _VERIFY_H
+#define _VERIFY_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+// What is wrong with a ROM file, in the order they are checked
+enum ROM_STATUS {
+	ROM_OK,
+	ROM_UNREADABLE,		// cannot be opened
+	ROM_SHORT,			// smaller than a header
+	ROM_MAGIC,			// no CH16 magic number
+	ROM_TRUNCATED,		// less data than rom_size says
+	ROM_TRAILING,		// more data than rom_size says
+	ROM_CRC				// crc32_sum does not match the data
+};
+
+// Check the header and CRC of ROM files, mapping them on a number of
+// threads. Prints a JSON summary to the stream: totals, the spec versions
+// seen, and every file that is not ROM_OK. false if there was any.
+bool verifyRoms(const std::vector<std::string>&,unsigned,std::ostream&);
+
+#endif
@@ -0,0 +1,95 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sstream>
+
+#include "libtchip16.h"
+#include "Assembler.h"
+#include "Error.h"
+
+const char* tchip16_ver = "tchip16 1.4.6 -- a chip16 assembler\n";
+
+// Build with an assembler that has just been made or reset
+static bool assembleWith(Assembler& tc16, std::ostringstream& diag,
+                         const std::vector<std::string>& sources, FileProvider& files,
+                         const AssembleOptions& opts, RomImage& out) {
+    tc16.setFileProvider(&files);
+    if(opts.align)
+        tc16.useAlign();
+    if(opts.zeroFill)
+        tc16.useZeroFill();
+    if(opts.raw)
+        tc16.noHeader();
+
+    tc16.setErrorStream(&diag);
+    bool read = true;
+    for(unsigned i=0; i<sources.size() && read; ++i)
+        read = tc16.tokenize(sources[i].c_str());
+    if(read) {
+        tc16.resolveConsts();
+        tc16.buildRom();
+    }
+
+    out.ok = read && !tc16.failed();
+    out.diagnostics = diag.str();
+    out.header = tc16.romHeader();
+    out.rom.clear();
+    out.symbols.clear();
+    if(!out.ok)
+        return false;
+    if(tc16.hasHeader()) {
+        const unsigned char* h = (const unsigned char*)&out.header;
+        out.rom.assign(h,h + sizeof(ch16_header));
+    }
+    out.rom.insert(out.rom.end(),tc16.romData(),tc16.romData() + tc16.romSize());
+    const SymbolTable& symbols = tc16.symbolTable();
+    for(int i=0; i<symbols.size(); ++i) {
+        if(symbols[i].kind == SYM_NONE)
+            continue;
+        RomSymbol sym;
+        sym.name = symbols[i].name;
+        sym.value = symbols[i].value;
+        sym.label = symbols.isLabel(i);
+        out.symbols.push_back(sym);
+    }
+    return true;
+}
+
+bool assembleRom(const std::vector<std::string>& sources, FileProvider& files,
+                 const AssembleOptions& opts, RomImage& out) {
+    Assembler tc16;
+    std::ostringstream diag;
+    return assembleWith(tc16,diag,sources,files,opts,out);
+}
+
+bool assembleText(std::string_view text, const AssembleOptions& opts, RomImage& out) {
+    MemoryFiles files;
+    files.add("source.s",text);
+    return assembleRom(std::vector<std::string>(1,"source.s"),files,opts,out);
+}
+
+RomBuilder::RomBuilder() : tc16(new Assembler), diag(new std::ostringstream),
+                           textName(1,"source.s") {
+}
+
+RomBuilder::~RomBuilder() {
+    delete tc16;
+    delete diag;
+}
+
+bool RomBuilder::assemble(const std::vector<std::string>& sources, FileProvider& files,
+                          const AssembleOptions& opts, RomImage& out) {
+    tc16->reset();
+    diag->str("");
+    return assembleWith(*tc16,*diag,sources,files,opts,out);
+}
+
+bool RomBuilder::assembleText(std::string_view text, const AssembleOptions& opts, RomImage& out) {
+    textFiles.add(textName[0],text);
+    return assemble(textName,textFiles,opts,out);
+}
@@ -0,0 +1,79 @@
+/*
+	tchip16, an open-source Chip16 assembler
+    Copyright (C) 2010-13  Tim Kelsall
+	[...]
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LIBTCHIP16_H
+#define _LIBTCHIP16_H
+
+// libtchip16: assemble in memory, without going through files or the
+// tchip16 binary. Link with libtchip16.a (make lib) and -pthread.
+
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "FileProvider.h"
+#include "RomHeader.h"
+
+struct RomSymbol {
+	std::string name;
+	int value;
+	bool label;			// label (or importbin), else a constant
+};
+
+struct RomImage {
+	bool ok;							// false if there were errors
+	ch16_header header;
+	// What tchip16 would write to the .c16: the header (unless raw), then
+	// the program
+	std::vector<unsigned char> rom;
+	std::vector<RomSymbol> symbols;		// in order of definition
+	std::string diagnostics;			// error messages, as tchip16 prints them
+};
+
+// Version banner, as printed by tchip16 --version
+extern const char* tchip16_ver;
+
+// Command line options that change the output
+struct AssembleOptions {
+	bool align;			// -a
+	bool zeroFill;		// -z
+	bool raw;			// -r
+	AssembleOptions() : align(false), zeroFill(false), raw(false) {}
+};
+
+// Assemble sources read, with what they include or import, through a
+// file provider; returns RomImage::ok
+bool assembleRom(const std::vector<std::string>&,FileProvider&,const AssembleOptions&,RomImage&);
+// Assemble a single source given as text, which cannot include or
+// import any file
+bool assembleText(std::string_view,const AssembleOptions&,RomImage&);
+
+class Assembler;
+
+// The same, keeping the assembler and its memory from one build to the
+// next. Once it has built a program as large, a build does not allocate
+// (the RomImage aside, if it isn't reused too). One per thread.
+class RomBuilder {
+public:
+	RomBuilder();
+	~RomBuilder();
+	bool assemble(const std::vector<std::string>&,FileProvider&,const AssembleOptions&,RomImage&);
+	bool assembleText(std::string_view,const AssembleOptions&,RomImage&);
+
+private:
+	RomBuilder(const RomBuilder&);
+	RomBuilder& operator=(const RomBuilder&);
+
+	Assembler* tc16;
+	std::ostringstream* diag;
+	MemoryFiles textFiles;				// what assembleText() builds
+	std::vector<std::string> textName;
+};
+
+#endif
@@ -17,19 +17,34 @@
 */
 
 #include <iostream>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
 
 #include "Error.h"
 #include "Assembler.h"
+#include "Batch.h"
+#include "Verify.h"
+#include "AllocCount.h"
+#include "Trace.h"
 
 void helpOut();
 
-const char* tchip16_ver = "tchip16 1.4.6 -- a chip16 assembler\n";
+extern const char* tchip16_ver;
 
 int main(int argc, char* argv[]) {
 
 	Assembler* tc16 = new Assembler();
 
 	int nbFiles = 0;
+	const char* memoDir = NULL;
+	const char* batchFile = NULL;
+	bool verify = false;
+	int stats = 0;								// 1 for a table, 2 for JSON
+#ifdef TCHIP16_TRACE
+	const char* traceFile = NULL;
+#endif
+	int jobs = 0;
 
 	// Source of a silly bug -- was only checking if argc > 2 (doesn't work with lone arg)
 	if(argc > 1) {
@@ -64,6 +79,38 @@ int main(int argc, char* argv[]) {
 					tc16->putMmap();
                 else if(arg == "-r" || arg == "-R" || arg == "--raw")
                     tc16->noHeader();
+                else if(arg == "--memo") {
+                    if(argc > i+1)
+                        memoDir = argv[++i];
+                    else
+                        Error::error(ERR_CMD_NONE);
+                }
+                else if(arg == "--batch") {
+                    if(argc > i+1)
+                        batchFile = argv[++i];
+                    else
+                        Error::error(ERR_CMD_NONE);
+                }
+                else if(arg == "--verify")
+                    verify = true;
+                else if(arg == "--stats")
+                    stats = 1;
+                else if(arg == "--stats=json")
+                    stats = 2;
+#ifdef TCHIP16_TRACE
+                else if(arg == "--trace") {
+                    if(argc > i+1)
+                        traceFile = argv[++i];
+                    else
+                        Error::error(ERR_CMD_NONE);
+                }
+#endif
+                else if(arg == "-j" || arg == "-J" || arg == "--jobs") {
+                    if(argc > i+1)
+                        jobs = atoi(argv[++i]);
+                    else
+                        Error::error(ERR_CMD_NONE);
+                }
                 else if(arg == "-h" || arg == "-H" || arg == "--help") {
                     helpOut();
                     return 0;
@@ -111,15 +158,65 @@ int main(int argc, char* argv[]) {
 		Error::error(ERR_NO_INPUT);
         return 1;
     }
+    // Jobs run one per thread, using every core unless told otherwise
+    unsigned threads = jobs > 0 ? jobs : std::thread::hardware_concurrency();
+    if(threads == 0)
+        threads = 1;
+    if(batchFile) {
+        std::vector<BatchJob> batch;
+        if(!readManifest(batchFile,batch,std::cout))
+            return 1;
+        return runBatch(batch,threads,std::cout) ? 0 : 1;
+    }
+    if(verify) {
+        // @LIST stands for the files listed in LIST, one per line
+        std::vector<std::string> roms;
+        for(int i=0; i<nbFiles; ++i) {
+            if(argv[1+i][0] != '@') {
+                roms.push_back(argv[1+i]);
+                continue;
+            }
+            std::ifstream list(argv[1+i]+1);
+            if(!list) {
+                Error::error(ERR_IO,argv[1+i]+1,0,"--verify");
+                return 1;
+            }
+            std::string rom;
+            while(std::getline(list,rom)) {
+                if(!rom.empty())
+                    roms.push_back(rom);
+            }
+        }
+        return verifyRoms(roms,threads,std::cout) ? 0 : 1;
+    }
 #ifdef _DEBUG
 	tc16->useVerbose();
 #endif
+    tc16->setJobs(jobs);
+    if(stats)
+        tc16->useStats(heapAllocations);
+#ifdef TCHIP16_TRACE
+    if(traceFile)
+        traceStart();
+#endif
+    // Once all options are known, they are part of the cache keys
+    if(memoDir) {
+        tc16->useMemo(memoDir);
+        if(tc16->restoreOutput(argv+1,nbFiles)) {
+            if(tc16->isVerbose())
+                std::cout << "\nBuild complete.\n";
+            return 0;
+        }
+    }
     // Do stuff!
     for(int i=0; i<nbFiles; ++i)
-        tc16->tokenize(argv[1+i]);
+        tc16->prefetch(argv[1+i]);
+    for(int i=0; i<nbFiles; ++i) {
+        if(!tc16->tokenize(argv[1+i]))
+            return 1;
+    }
     if(tc16->isVerbose())
         std::cout << "Built tokens\n";
-	tc16->fixOps();
 	tc16->resolveConsts();
 #ifdef _DEBUG
 	tc16->debugOut();
@@ -127,11 +224,19 @@ int main(int argc, char* argv[]) {
 	tc16->outputFile();
 	if(tc16->isVerbose())
 		std::cout << "\nBuild complete.\n";
+    if(stats)
+        tc16->buildStats().print(std::cout,stats == 2);
+#ifdef TCHIP16_TRACE
+    if(traceFile && !traceWrite(traceFile)) {
+        Error::error(ERR_IO,traceFile,0,"--trace");
+        return 1;
+    }
+#endif
 
 #ifdef _DEBUG
 	WAIT;
 #endif
-	return 0;
+	return tc16->failed() ? 1 : 0;
 }
 
 void helpOut() {
@@ -142,10 +247,23 @@ void helpOut() {
 		"    -o DEST: output file is DEST\n"
 		"    -a, --align: align labels to 4-byte boundaries\n"
 		"    -z, --zero: if assembled code < 64K, zero rest up to 64K\n"
-        "    -r, --raw: do not output header, only raw chip16 ROM\n\n"
+        "    -r, --raw: do not output header, only raw chip16 ROM\n"
+        "    -j N, --jobs N: read sources and write the output with N threads\n"
+        "    --memo DIR: keep outputs in DIR, to skip building unchanged sources again\n"
+        "    --batch FILE: build every ROM listed in FILE, one per line as\n"
+        "        SOURCE... -o DEST [-a] [-z] [-r], on -j N threads (default: all cores)\n"
+        "    --verify: check the header and CRC of SOURCE... as built ROMs, on -j N\n"
+        "        threads, and print a JSON summary (@LIST for the files listed in LIST)\n\n"
 		"Information options:\n\n"
         "    -m, --mmap: output mmap.txt which displays the address of each label\n"
-		"    -v, --verbose: switch to verbose output (default is silent)\n\n"
+		"    -v, --verbose: switch to verbose output (default is silent)\n"
+        "    --stats: print the time, bytes, statements, tokens, symbols, heap\n"
+        "        allocations and peak memory of each phase of the build\n"
+        "    --stats=json: the same, as JSON\n"
+#ifdef TCHIP16_TRACE
+        "    --trace FILE: write a timeline of the build to FILE, for chrome://tracing\n"
+#endif
+        "\n"
         "Miscellaneous options:\n\n"
 		"    -h, --help: display this help text and exit\n"
         "    --version: display version information and exit\n\n"